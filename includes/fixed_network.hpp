@@ -0,0 +1,109 @@
+#ifndef FIXED_NETWORK_H
+#define FIXED_NETWORK_H
+
+#include <cstddef>
+#include "../mlp_nn/real.h"
+#include "../mlp_nn/matrix.h"
+#include "../mlp_nn/simd.h"
+
+//Forward pass of a network whose topology is fixed at compile time: FixedNetwork<784, 200, 2> is
+//the 784-200-2 MLP of the ImageClassifier. The weights are plain arrays (static storage when the
+//network is, see mlp_nn/gen_network which writes one from a weights file) and every loop bound is
+//a constant, so the compiler unrolls and vectorizes the layers for the target it builds for
+//instead of going through the runtime sized Matrix. A pass allocates nothing, the activations
+//live on the stack.
+
+//Columns of a layer accumulated together, 8 vectors of the target: their sums stay in registers
+//while the inputs stream by, enough independent sums to keep the multiply-add units busy
+#if defined(__AVX512F__)
+#define FIXED_VECTOR_BYTES 64
+#elif defined(__AVX__)
+#define FIXED_VECTOR_BYTES 32
+#else
+#define FIXED_VECTOR_BYTES 16
+#endif
+#define FIXED_COLUMN_BLOCK (FIXED_VECTOR_BYTES / sizeof(mlp_real) * 8)
+
+//Elements between the rows of a layer of Out nodes: rows are padded with zeros to MATRIX_ALIGNMENT
+//like in the matrix storage, so no vector load straddles two cache lines
+constexpr size_t fixedStride(size_t out) {
+    return (out * sizeof(mlp_real) + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT / sizeof(mlp_real);
+}
+
+//output = activation(input * weights), a block of columns at a time
+template <size_t In, size_t Out, size_t FirstColumn = 0>
+inline void fixedDense(const mlp_real (&weights)[In][fixedStride(Out)], const mlp_real* input, mlp_real* output, SigmoidKernel activation) {
+    if constexpr (FirstColumn < Out) {
+        constexpr size_t width = Out - FirstColumn < FIXED_COLUMN_BLOCK ? Out - FirstColumn : FIXED_COLUMN_BLOCK;
+        mlp_real sums[width] = {};
+        for (size_t k = 0; k < In; k++) {
+            const mlp_real x = input[k];
+            const mlp_real* row = weights[k] + FirstColumn;
+#pragma GCC unroll 64
+            for (size_t j = 0; j < width; j++)
+                sums[j] += x * row[j];
+        }
+#pragma GCC unroll 64
+        for (size_t j = 0; j < width; j++)
+            output[FirstColumn + j] = sums[j];
+        fixedDense<In, Out, FirstColumn + width>(weights, input, output, activation);
+    } else {
+        activation(Out, output);
+    }
+}
+
+//Weights of the layer from In to Out nodes and of the ones after it
+template <size_t In, size_t Out, size_t... Rest>
+struct FixedLayers {
+    alignas(MATRIX_ALIGNMENT) mlp_real weights[In][fixedStride(Out)];
+    FixedLayers<Out, Rest...> next;
+
+    void forward(const mlp_real* input, mlp_real* output, SigmoidKernel activation) const {
+        alignas(MATRIX_ALIGNMENT) mlp_real hidden[Out];
+        fixedDense<In, Out>(weights, input, hidden, activation);
+        next.forward(hidden, output, activation);
+    }
+};
+
+//The last layer
+template <size_t In, size_t Out>
+struct FixedLayers<In, Out> {
+    alignas(MATRIX_ALIGNMENT) mlp_real weights[In][fixedStride(Out)];
+
+    void forward(const mlp_real* input, mlp_real* output, SigmoidKernel activation) const {
+        fixedDense<In, Out>(weights, input, output, activation);
+    }
+};
+
+//Nodes of the first and last of the layers
+template <size_t First, size_t... Rest>
+struct FixedShape {
+    static constexpr size_t first = First;
+    static constexpr size_t last = sizeof...(Rest) == 0 ? First : FixedShape<Rest...>::last;
+};
+
+template <size_t First>
+struct FixedShape<First> {
+    static constexpr size_t first = First;
+    static constexpr size_t last = First;
+};
+
+//An aggregate so a network can be written out as an initializer: the sigmoid mode, then every
+//weight layer by layer, row after row (padded rows, see fixedStride())
+template <size_t... Layers>
+struct FixedNetwork {
+    static_assert(sizeof...(Layers) >= 2, "A network has at least an input and an output layer");
+    static constexpr size_t numLayers = sizeof...(Layers);
+    static constexpr size_t numInputs = FixedShape<Layers...>::first;
+    static constexpr size_t numOutputs = FixedShape<Layers...>::last;
+
+    SigmoidMode sigmoidMode;
+    FixedLayers<Layers...> layers;
+
+    //Pass the inputs (numInputs values) through the network into the outputs (numOutputs values)
+    void forward(const mlp_real* inputs, mlp_real* outputs) const {
+        layers.forward(inputs, outputs, simd_sigmoid_kernel(simd_kernels(), sigmoidMode));
+    }
+};
+
+#endif
@@ -1,4 +1,10 @@
 #include "image_classifier.hpp"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <sstream>
+#include <thread>
+#include "bounded_queue.hpp"
 extern "C" {
    #define STB_IMAGE_IMPLEMENTATION
    #include "../stb_image/stb_image.h"
@@ -25,15 +31,15 @@ int ImageClassifier::train_from_dataset(const char* dataset) {
     Matrix input_nodes;
     Matrix output_nodes;
 
-    printf("No Input: %i No Output: %i\n", neural_network.num_inputs, neural_network.num_outputs);
-    printf("Learning Rate: %f Epoch: %i\n", neural_network.learning_rate, neural_network.epoch);
-    printf("Hidden Layers:\n");
+    mlp_log(MLP_LOG_INFO, "No Input: %i No Output: %i", neural_network.num_inputs, neural_network.num_outputs);
+    mlp_log(MLP_LOG_INFO, "Learning Rate: %f Epoch: %i", neural_network.learning_rate, neural_network.epoch);
+    mlp_log(MLP_LOG_INFO, "Hidden Layers:");
     for (int i = 0; i < num_of_hidden_layers; i++) {
-        printf("= %d =\n", neural_network.num_hidden[i]);
+        mlp_log(MLP_LOG_INFO, "= %d =", neural_network.num_hidden[i]);
     }
 
     if (!read_dataset(dataset, neural_network.num_inputs, neural_network.num_outputs, &input_nodes, &output_nodes)) {
-        printf("Error reading the data set (check if file exists)\n");
+        mlp_log(MLP_LOG_ERROR, "Cannot read the data set %s (check if file exists)", dataset);
         free_matrix(&input_nodes);
         free_matrix(&output_nodes);
         return -1;
@@ -59,22 +65,32 @@ int ImageClassifier::train_from_dataset_load_weights(const char* dataset, const
     Matrix input_nodes;
     Matrix output_nodes;
 
-    printf("No Input: %i No Output: %i\n", neural_network.num_inputs, neural_network.num_outputs);
-    printf("Learning Rate: %f Epoch: %i\n", neural_network.learning_rate, neural_network.epoch);
-    printf("Hidden Layers:\n");
+    mlp_log(MLP_LOG_INFO, "No Input: %i No Output: %i", neural_network.num_inputs, neural_network.num_outputs);
+    mlp_log(MLP_LOG_INFO, "Learning Rate: %f Epoch: %i", neural_network.learning_rate, neural_network.epoch);
+    mlp_log(MLP_LOG_INFO, "Hidden Layers:");
     for (int i = 0; i < num_of_hidden_layers; i++) {
-        printf("= %d =\n", neural_network.num_hidden[i]);
+        mlp_log(MLP_LOG_INFO, "= %d =", neural_network.num_hidden[i]);
     }
 
     if (!read_dataset(dataset, neural_network.num_inputs, neural_network.num_outputs, &input_nodes, &output_nodes)) {
-        printf("Error reading the data set (check if file exists)\n");
+        mlp_log(MLP_LOG_ERROR, "Cannot read the data set %s (check if file exists)", dataset);
         free_matrix(&input_nodes);
         free_matrix(&output_nodes);
         return -1;
     } else {
         Matrix* inputs = get_row_matrix(&input_nodes, 0);
 
+        //Weights mapped by load_weights() are read only, training needs its own copy
+        if (neural_network.weights != NULL)
+            free_mlp_weights(&neural_network, num_of_hidden_layers + 1);
         size_t num_weight_layers = load_mlp_weights(&neural_network, weightsFile, num_of_hidden_layers);
+        if (num_weight_layers == 0) {
+            free_matrix(inputs);
+            free(inputs);
+            free_matrix(&input_nodes);
+            free_matrix(&output_nodes);
+            return -1;
+        }
 
         init_mlp_model(&neural_network, inputs, num_weight_layers);
 
@@ -99,15 +115,54 @@ int ImageClassifier::save_weights(const char* weightsFile) {
 }
 
 int ImageClassifier::load_weights(const char* weightsFile) {
-    size_t num_weight_layers = load_mlp_weights(&neural_network, weightsFile, num_of_hidden_layers);
+    //Weights files with a header describe the network, take its shape from there
+    MLP_WeightsInfo info;
+    if (read_mlp_weights_info(weightsFile, &info)) {
+        delete[] hidden_layer_nodes;
+        num_of_hidden_layers = info.num_layers - 2;
+        hidden_layer_nodes = new unsigned int[num_of_hidden_layers + 1];
+        for (size_t i = 0; i < num_of_hidden_layers; i++)
+            hidden_layer_nodes[i] = info.layers[i + 1];
+        neural_network.num_inputs = info.layers[0];
+        neural_network.num_outputs = info.layers[info.num_layers - 1];
+        neural_network.num_hidden = hidden_layer_nodes;
+    }
+    //Map the weights when the file allows it (instant whatever the size, shared between processes),
+    //read them otherwise (legacy files and files of the other precision)
+    size_t num_weight_layers = 0;
+    if (info.num_layers > 0 && info.element_size == sizeof(mlp_real))
+        num_weight_layers = map_mlp_weights(&neural_network, weightsFile, num_of_hidden_layers);
+    if (num_weight_layers == 0)
+        num_weight_layers = load_mlp_weights(&neural_network, weightsFile, num_of_hidden_layers);
+    return num_weight_layers > 0 ? 0 : -1;
+}
+
+int ImageClassifier::load_quantized_weights(const char* weightsFile) {
+    if (quantized) {
+        free_quant_plan(&quantized_plan);
+        free_quant_mlp(&quantized_network);
+        quantized = false;
+    }
+    if (!load_quant_mlp(&quantized_network, weightsFile))
+        return -1;
+    if (!init_quant_plan(&quantized_plan, &quantized_network, 1)) {
+        free_quant_mlp(&quantized_network);
+        return -1;
+    }
+    quantized = true;
     return 0;
 }
 
 void ImageClassifier::forward_propagate_img(const char* imagePath) {
     Matrix inputs;
     flatten_img_data(imagePath, &inputs);
+    if (quantized) {
+        quant_forward(&quantized_plan, &quantized_network, &inputs);
+        free_matrix(&inputs);
+        return;
+    }
     size_t num_weight_layers = num_of_hidden_layers + 1;
-    if (neural_network.neurons == NULL)
+    if (neural_network.neurons == NULL && neural_network.weights != NULL)
         init_mlp_model(&neural_network, &inputs, num_weight_layers);
 
     if (neural_network.neurons != NULL)
@@ -140,59 +195,197 @@ void ImageClassifier::flatten_img_data(const char* filePath, Matrix* result, Col
     stbi_image_free(imgData);
 }
 
-void ImageClassifier::create_dataset_from_dir(const char* datasetPath, const std::vector<std::string>& directories) {
-    // Write to data file
-    std::ofstream dataFile;
-    dataFile.open(datasetPath);
+//Pixel values as the data set text holds them. A pixel is one of 256 values, so each is
+//formatted once (through the same stream formatting as a float r / 255 would get) and rows are
+//put together from the table instead of going through the stream for every pixel
+static const std::vector<std::string>& pixel_strings() {
+    static const std::vector<std::string> table = []() {
+        std::vector<std::string> strings(256);
+        for (int r = 0; r < 256; r++) {
+            std::ostringstream text;
+            float r_scaled = r / 255.0f;
+            text << r_scaled << ",";
+            strings[r] = text.str();
+        }
+        return strings;
+    }();
+    return table;
+}
 
-    // Iterate through files in the specified directories
-    int i = 0;
-    std::string nl = "";
-    for (const auto& directory : directories) {
-        if (std::filesystem::exists(directory) && std::filesystem::is_directory(directory)) {
-            for (const auto& entry : std::filesystem::directory_iterator(directory)) {
-                std::string filename = entry.path();
-                int x,y,n;
-                unsigned char* data = stbi_load(filename.c_str(), &x, &y, &n, 0);
-                // Process data if not NULL
-                if (data != nullptr && x > 0 && y > 0) {
-                    if (n == 3) {
-                        dataFile << nl;
-                        for (int i = 0; i < x * y; i++) {
-                            // Access the R component of the pixel
-                            unsigned char r = data[i * n + 0];
-                            float r_scaled = r / 255.0f;
-                            // Will cast the results to int
-                            dataFile << r_scaled;
-                            // Print a new line at the end of each row
-                            // dataFile << ((i % x == x - 1) ? '\n' : ' ');
-                            dataFile << ",";
-                        }
-                        // Output vectors
-                        std::string delim = "";
-                        for (const auto& directory : directories) {
-                            dataFile << delim << ((directory == directories[i]) ? "1" : "0");
-                            delim = ",";
-                        }
-                        nl = "\n";
-                    }
-                }
-                else {
-                    std::cout << "Some error\n";
-                }
+//Append a data set row for the image (the colour channel of every pixel followed by a comma, then
+//the outputs with a 1 for the image class) to row
+static void format_dataset_row(std::string& row, const unsigned char* data, int numPixels, int numChannels,
+                               const std::vector<std::string>& directories, size_t outputIndex) {
+    const std::vector<std::string>& pixels = pixel_strings();
+    row.reserve(row.size() + (size_t)numPixels * 9 + directories.size() * 2);
+    for (int i = 0; i < numPixels; i++)
+        row += pixels[data[i * numChannels + 0]];
+    // Output vectors
+    for (size_t i = 0; i < directories.size(); i++) {
+        if (i > 0)
+            row += ',';
+        row += (directories[i] == directories[outputIndex]) ? '1' : '0';
+    }
+}
 
-                // Free image data
-                stbi_image_free(data);
+//Content hash of the colour channel the data set keeps (see sample_hash() in dataset.h)
+static uint64_t channel_hash(const unsigned char* data, int numPixels, int numChannels) {
+    std::vector<uint8_t> pixels(numPixels);
+    for (int i = 0; i < numPixels; i++)
+        pixels[i] = data[i * numChannels + 0];
+    return sample_hash(pixels.data(), pixels.size());
+}
+
+//An image for the decode stage: where its row goes in the data set and its class
+struct ImageTask {
+    size_t index;
+    std::string path;
+    size_t outputIndex;
+};
+
+//Data set row of a decoded image and its content hash for the writer (empty when it is not an
+//RGB image)
+struct DecodedImage {
+    size_t index;
+    bool loaded;
+    std::string row;
+    uint64_t hash;
+};
+
+//Images queued between the stages (enough to keep every decoder busy without holding the whole
+//data set in memory)
+const size_t IMAGE_QUEUE_CAPACITY = 256;
+
+//Decode stage: load the images and format their rows, so the writer only has to write
+static void decode_images(BoundedQueue<ImageTask>& tasks, BoundedQueue<DecodedImage>& decoded,
+                          const std::vector<std::string>& directories) {
+    ImageTask task;
+    while (tasks.pop(task)) {
+        DecodedImage image = {task.index, false, "", 0};
+        int x,y,n;
+        unsigned char* data = stbi_load(task.path.c_str(), &x, &y, &n, 0);
+        if (data != nullptr && x > 0 && y > 0) {
+            image.loaded = true;
+            if (n == 3) {
+                format_dataset_row(image.row, data, x * y, n, directories, task.outputIndex);
+                image.hash = channel_hash(data, x * y, n);
             }
         }
-        i++;
+        stbi_image_free(data);
+        decoded.push(std::move(image));
+    }
+}
+
+void ImageClassifier::create_dataset_from_dir(const char* datasetPath, const std::vector<std::string>& directories, unsigned int numThreads) {
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    //Hashes of the images written so far, to skip the duplicates
+    SampleHashSet written;
+    if (!init_sample_hashes(&written, IMAGE_QUEUE_CAPACITY)) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate the image hashes to build %s", datasetPath);
+        return;
+    }
+    BoundedQueue<ImageTask> tasks(IMAGE_QUEUE_CAPACITY);
+    BoundedQueue<DecodedImage> decoded(IMAGE_QUEUE_CAPACITY);
+
+    //Enumeration stage: number the files of every directory in order
+    std::thread lister([&]() {
+        size_t index = 0;
+        for (size_t d = 0; d < directories.size(); d++) {
+            if (std::filesystem::exists(directories[d]) && std::filesystem::is_directory(directories[d])) {
+                std::error_code error;
+                for (const auto& entry : std::filesystem::directory_iterator(directories[d], error))
+                    tasks.push({index++, entry.path().string(), d});
+            }
+        }
+        tasks.close();
+    });
+
+    //Decode stage, the last decoder to finish closes the writer queue
+    std::atomic<unsigned int> runningDecoders(numThreads);
+    std::vector<std::thread> decoders;
+    for (unsigned int t = 0; t < numThreads; t++) {
+        decoders.emplace_back([&]() {
+            decode_images(tasks, decoded, directories);
+            if (--runningDecoders == 0)
+                decoded.close();
+        });
     }
 
+    //Writer stage: images finish out of order, each is held back until the rows before it are
+    //written so the data set follows the listing order. Every row is a single write, images whose
+    //content was already written are skipped. When the hashes cannot grow the rest is only drained
+    //so the other stages finish, and the data set is not built
+    std::ofstream dataFile;
+    dataFile.open(datasetPath);
+    bool firstRow = true;
+    bool failed = false;
+    size_t duplicates = 0;
+    std::map<size_t, DecodedImage> pending;
+    size_t next = 0;
+    DecodedImage image;
+    while (decoded.pop(image)) {
+        pending.emplace(image.index, std::move(image));
+        for (auto it = pending.find(next); it != pending.end(); it = pending.find(++next)) {
+            const DecodedImage& row = it->second;
+            int added = !failed && row.loaded && !row.row.empty() ? sample_hashes_insert(&written, row.hash) : 1;
+            if (failed) {
+                //Drained only
+            } else if (!row.loaded) {
+                std::cout << "Some error\n";
+            } else if (added < 0) {
+                failed = true;
+            } else if (added == 0) {
+                duplicates++;
+            } else if (!row.row.empty()) {
+                if (!firstRow)
+                    dataFile.put('\n');
+                dataFile.write(row.row.data(), row.row.size());
+                firstRow = false;
+            }
+            pending.erase(it);
+        }
+    }
+
+    lister.join();
+    for (auto& decoder : decoders)
+        decoder.join();
+
     // Close data file
     dataFile.close();
+    if (failed) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate the image hashes to build %s", datasetPath);
+        std::error_code error;
+        std::filesystem::remove(datasetPath, error);
+        free_sample_hashes(&written);
+        return;
+    }
+    if (duplicates > 0)
+        std::cout << "Skipped " << duplicates << " duplicate images\n";
+
+    //Index the rows and keep the hashes for appends and loaders (see dataset.h), the file is
+    //still in the page cache
+    MappedFile file;
+    DatasetIndex index;
+    if (map_file(datasetPath, &file)) {
+        if (build_dataset_index(file.data, file.size, directories.size(), &index)) {
+            save_dataset_index(datasetPath, &index);
+            free_dataset_index(&index);
+        }
+        written.data_size = file.size;
+        save_sample_hashes(datasetPath, &written);
+        unmap_file(&file);
+    }
+    free_sample_hashes(&written);
 }
 
 void ImageClassifier::append_img_to_dataset(const char* datasetPath, const char* imagePath, const std::vector<std::string>& directories, int outputIndex) {
+    //Size before the row, where the index picks up
+    std::error_code error;
+    uint64_t dataSize = std::filesystem::file_size(datasetPath, error);
+    if (error)
+        dataSize = 0;
+
     //Write to data file
     std::ofstream dataFile(datasetPath, std::ios::app);
 
@@ -205,22 +398,20 @@ void ImageClassifier::append_img_to_dataset(const char* datasetPath, const char*
     //Process data if not NULL ..
     if (data != nullptr && x > 0 && y > 0) {
             if (n == 3) {
-                dataFile << '\n';
-                for (int i = 0; i < x * y; i++) {
-                    //Access the R component of the pixel
-                    unsigned char r = data[i * n + 0];
-                    float r_scaled = r / 255.0f;
-                    //Will cast the results to int
-                    dataFile << r_scaled;
-                    //Comma delimiter
-                    dataFile << ",";
-                }
-                // Output vectors
-                std::string delim = "";
-                for (size_t i = 0; i < directories.size(); i++) {
-                    dataFile << delim << ((i == outputIndex) ? "1" : "0");
-                    delim = ",";
+                //The whole row is formatted first and written at once
+                std::string row = "\n";
+                format_dataset_row(row, data, x * y, n, directories, outputIndex);
+                //The hash file answers whether the image is in the data set already
+                if (add_sample_hash(datasetPath, dataSize, dataSize + row.size(), channel_hash(data, x * y, n), directories.size()) == 0) {
+                    std::cout << "Image is already in the data set, skipped\n";
+                    dataFile.close();
+                    stbi_image_free(data);
+                    return;
                 }
+                dataFile.write(row.data(), row.size());
+                dataFile.close();
+                //One record in the row index instead of re-parsing the data set later
+                append_dataset_index(datasetPath, dataSize, dataSize + 1, row.size() - 1, outputIndex, directories.size());
         }
     }
     else {
@@ -232,11 +423,11 @@ void ImageClassifier::append_img_to_dataset(const char* datasetPath, const char*
 }
 
 size_t ImageClassifier::classify_max_column_index() {
-    if (neural_network.neurons == NULL) {
+    if (!quantized && neural_network.neurons == NULL) {
         return -1;
     }
 
-    Matrix result_mat = neural_network.neurons[num_of_hidden_layers + 1];
+    Matrix result_mat = quantized ? quantized_plan.outputs : neural_network.neurons[num_of_hidden_layers + 1];
     size_t maxIndex = 0;
     for (int i = 0; i < result_mat.columns; i++) {
         if (result_mat.data[0][i] > result_mat.data[0][maxIndex])
@@ -247,10 +438,12 @@ size_t ImageClassifier::classify_max_column_index() {
 }
 
 ImageClassifier::~ImageClassifier() {
-    printf("Dellaocating\n");
+    if (quantized) {
+        free_quant_plan(&quantized_plan);
+        free_quant_mlp(&quantized_network);
+    }
     size_t num_weight_layers = num_of_hidden_layers + 1;
-    if (neural_network.weights != NULL)
-        free_mat_array(&neural_network.weights, num_weight_layers);
+    free_mlp_weights(&neural_network, num_weight_layers);
     if (neural_network.neurons != NULL)
         free_mat_array(&neural_network.neurons, num_weight_layers + 1);
     
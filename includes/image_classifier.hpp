@@ -6,6 +6,7 @@
 #include <filesystem>
 #include <vector>
 #include "../mlp_nn/mlp_nn.h"
+#include "../mlp_nn/quant.h"
 
 enum ColourChannel { RED = 0, GREEN = 1, BLUE = 2 };
 
@@ -22,12 +23,15 @@ public:
     //Load and save weights
     int save_weights(const char* weightsFile);
     int load_weights(const char* weightsFile);
+    //Load int8 weights (see mlp_nn/quant.h), the forward passes then run on them
+    int load_quantized_weights(const char* weightsFile);
     //Forward propagate
     void forward_propagate_img(const char* imagePath);
     //Will flatten the grayscaled image by reading the specified colour channel values and return Matrix
     static void flatten_img_data(const char* filePath, Matrix* result, ColourChannel channel = RED);
-    //Create data set from directories that contain the images
-    static void create_dataset_from_dir(const char* datasetPath, const std::vector<std::string>& directories);
+    //Create data set from directories that contain the images. The images are listed, decoded on
+    //numThreads threads (0 uses every core) and written in listing order by a pipeline
+    static void create_dataset_from_dir(const char* datasetPath, const std::vector<std::string>& directories, unsigned int numThreads = 0);
     static void append_img_to_dataset(const char* datasetPath, const char* imagePath, const std::vector<std::string>& directories, int outputIndex);
     //Get maximum output value from the neurons (Returns the index of the column, will only read the first row as the output layer is expected to only have one row)
     size_t classify_max_column_index();
@@ -36,6 +40,10 @@ private:
     //Num of weight layers = num of hidden layers + 1
     size_t num_of_hidden_layers;
     unsigned int* hidden_layer_nodes;
+    //Int8 network and its forward pass buffers, used instead of the neural network once loaded
+    QuantMLP quantized_network;
+    QuantPlan quantized_plan;
+    bool quantized = false;
 };
 
 #endif
\ No newline at end of file
@@ -44,6 +44,9 @@ int main(int argc, char* argv[]) {
     //This is the directories for the classification (there are 2 as of now)
     directories = {"dataset/cube", "dataset/pyramid"};
 
+    //Report what is loaded and the training progress (MLP_LOG=debug also prints every matrix)
+    mlp_set_log_level(MLP_LOG_INFO);
+
     //Pass in the arguments
     ImageClassifier img;
     if (parse_arguments(argc, argv, &img)) {
@@ -211,12 +214,17 @@ int parse_arguments(int argc, char* argv[], ImageClassifier* img_classifier) {
 
     //If one were to pass '-l weights.data -t dataset/shapes.data', train_from_dataset_load_weights() and
     //load_weights() together read and load the weights file twice. Not bothered right now to fix.
-    while ((opt = getopt(argc, argv, "l:t:o:c")) != -1) {
+    while ((opt = getopt(argc, argv, "l:q:t:o:c")) != -1) {
         switch (opt) {
             case 'l':
                 img_classifier->load_weights(optarg);
                 weightsFile = optarg; canPropgate = true;
                 break;
+            case 'q':
+                //Int8 weights from mlp_nn/quantize, for the forward pass only
+                if (img_classifier->load_quantized_weights(optarg) == 0)
+                    canPropgate = true;
+                break;
             case 't':
                 if (weightsFile) {
                     printf("[+] Training network on loaded weights file '%s'\n", weightsFile);
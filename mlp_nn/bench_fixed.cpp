@@ -0,0 +1,136 @@
+#include "mlp_nn.h"
+//Written by gen_network from the weights file (see the fixed target of the Makefile)
+#include "production_network.hpp"
+
+//Benchmark of the FixedNetwork generated from a weights file (see includes/fixed_network.hpp)
+//against the generic forward pass of the same file, one image at a time like the ImageClassifier
+//and in batches of BATCH_ROWS, on the samples of a data set:
+//  ./bench_fixed <weights> [data set, default ../dataset/test.data]
+
+#define BATCH_ROWS 64
+//Every pass is repeated for at least this long to time it
+#define MIN_SECONDS 0.5
+
+typedef decltype(productionNetwork) Network;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int argmax(const mlp_real* row, int n) {
+    int best = 0;
+    for (int j = 1; j < n; j++) {
+        if (row[j] > row[best])
+            best = j;
+    }
+    return best;
+}
+
+//Generic forward pass of the inputs, rows samples at a time, into outputs (when not NULL)
+static void run_generic(MLP_NN* mlp, MLP_Plan* plan, Matrix* inputs, Matrix* batch, int rows, Matrix* outputs) {
+    for (int first = 0; first < inputs->rows; first += rows) {
+        int n = inputs->rows - first < rows ? inputs->rows - first : rows;
+        resize_matrix(batch, n, inputs->columns);
+        for (int r = 0; r < n; r++)
+            memcpy(matrix_row(batch, r), matrix_row(inputs, first + r), inputs->columns * sizeof(mlp_real));
+        Matrix* predicted = mlp_plan_forward(plan, mlp, batch);
+        if (outputs == NULL)
+            continue;
+        for (int r = 0; r < n; r++)
+            memcpy(matrix_row(outputs, first + r), matrix_row(predicted, r), predicted->columns * sizeof(mlp_real));
+    }
+}
+
+static void run_fixed(Matrix* inputs, Matrix* outputs) {
+    alignas(64) mlp_real row[Network::numOutputs];
+    for (int r = 0; r < inputs->rows; r++) {
+        mlp_real* output = outputs != NULL ? matrix_row(outputs, r) : row;
+        productionNetwork.forward(matrix_row(inputs, r), output);
+    }
+}
+
+//Images per second of the generic pass (rows at a time) or of the fixed one (rows == 0)
+static double time_pass(MLP_NN* mlp, MLP_Plan* plan, Matrix* inputs, Matrix* batch, int rows) {
+    long images = 0;
+    double start = now_seconds(), seconds;
+    do {
+        if (rows > 0)
+            run_generic(mlp, plan, inputs, batch, rows, NULL);
+        else
+            run_fixed(inputs, NULL);
+        images += inputs->rows;
+        seconds = now_seconds() - start;
+    } while (seconds < MIN_SECONDS);
+    return images / seconds;
+}
+
+int
+main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <weights> [data set]\n", argv[0]);
+        return 1;
+    }
+    const char* dataset_path = argc > 2 ? argv[2] : "../dataset/test.data";
+
+    MLP_NN mlp{};
+    MLP_WeightsInfo info;
+    size_t num_weight_layers = load_mlp_model(&mlp, argv[1], &info);
+    if (num_weight_layers == 0)
+        return 1;
+    int matches = info.num_layers == Network::numLayers && mlp.num_inputs == Network::numInputs &&
+                  mlp.num_outputs == Network::numOutputs;
+    if (!matches)
+        mlp_log(MLP_LOG_ERROR, "%s does not have the topology production_network.hpp was generated for", argv[1]);
+
+    Matrix inputs, labels;
+    if (!matches || !read_dataset(dataset_path, mlp.num_inputs, mlp.num_outputs, &inputs, &labels)) {
+        free_mat_array(&mlp.weights, num_weight_layers);
+        return 1;
+    }
+
+    MLP_Plan plan;
+    if (!init_mlp_plan(&plan, &mlp, num_weight_layers, BATCH_ROWS)) {
+        free_matrix(&inputs);
+        free_matrix(&labels);
+        free_mat_array(&mlp.weights, num_weight_layers);
+        return 1;
+    }
+    Matrix batch, generic, fixed;
+    init_matrix(&batch, BATCH_ROWS, inputs.columns);
+    init_matrix(&generic, inputs.rows, mlp.num_outputs);
+    init_matrix(&fixed, inputs.rows, mlp.num_outputs);
+
+    //Both passes on every sample, then timed without looking at the outputs
+    run_generic(&mlp, &plan, &inputs, &batch, 1, &generic);
+    run_fixed(&inputs, &fixed);
+    int agree = 0;
+    double max_diff = 0;
+    for (int r = 0; r < inputs.rows; r++) {
+        agree += argmax(matrix_row(&generic, r), generic.columns) == argmax(matrix_row(&fixed, r), fixed.columns);
+        for (int j = 0; j < generic.columns; j++)
+            max_diff = fmax(max_diff, fabs(matrix_row(&generic, r)[j] - matrix_row(&fixed, r)[j]));
+    }
+    double generic_single = time_pass(&mlp, &plan, &inputs, &batch, 1);
+    double generic_batch = time_pass(&mlp, &plan, &inputs, &batch, BATCH_ROWS);
+    double fixed_single = time_pass(&mlp, &plan, &inputs, &batch, 0);
+
+    printf("Network: ");
+    for (unsigned int l = 0; l < info.num_layers; l++)
+        printf(l == 0 ? "%u" : "-%u", info.layers[l]);
+    printf(" as %s, generic kernels %s\n", MLP_REAL_NAME, simd_kernels()->name);
+    printf("%s (%d samples)\n", dataset_path, inputs.rows);
+    printf("  agreement  %.2f%% of the predictions, largest output difference %.2e\n", 100.0 * agree / inputs.rows, max_diff);
+    printf("  images/s   generic 1 x %10.0f   generic %d x %10.0f   fixed 1 x %10.0f   (%.1fx, %.1fx)\n",
+           generic_single, BATCH_ROWS, generic_batch, fixed_single, fixed_single / generic_single, fixed_single / generic_batch);
+
+    free_matrix(&fixed);
+    free_matrix(&generic);
+    free_matrix(&batch);
+    free_mlp_plan(&plan);
+    free_matrix(&inputs);
+    free_matrix(&labels);
+    free_mat_array(&mlp.weights, num_weight_layers);
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "matrix.h"
+#include "gemm.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+//Benchmark of the gemm() kernel behind dot_product() against the original triple loop for the
+//products done by train_mlp_model() on the 784-200-2 network, plus a few batched shapes. A second
+//table times dense layers (product + bias + sigmoid) done in separate passes against the fused
+//gemm_fused() epilogue
+
+typedef struct {
+    const char* name;
+    int trans_a, trans_b;
+    int m, n, k;
+} Shape;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Run the product repeatedly for at least min_time seconds and return the GFLOP/s
+static double time_kernel(int use_reference, Shape* shape, Matrix* a, Matrix* b, Matrix* c, double min_time) {
+    long reps = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        //Both kernels write into the preallocated result so only the arithmetic is timed
+        memset(c->buffer, 0, (size_t)c->rows * c->stride * sizeof(mlp_real));
+        if (use_reference)
+            gemm_reference(shape->trans_a, shape->trans_b, shape->m, shape->n, shape->k, 1.0,
+                           a->buffer, a->stride, b->buffer, b->stride, c->buffer, c->stride);
+        else
+            gemm(shape->trans_a, shape->trans_b, shape->m, shape->n, shape->k, 1.0,
+                 a->buffer, a->stride, b->buffer, b->stride, c->buffer, c->stride);
+        reps++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < min_time);
+
+    return 2.0 * shape->m * shape->n * shape->k * reps / elapsed * 1e-9;
+}
+
+//Run a dense layer repeatedly for at least min_time seconds and return the microseconds per layer
+static double time_dense(int fused, Shape* shape, Matrix* a, Matrix* b, const mlp_real* bias, Matrix* c, double min_time) {
+    const SimdKernels* kernels = simd_kernels();
+    GemmEpilogue epilogue = {bias, kernels->sigmoid};
+    long reps = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        memset(c->buffer, 0, (size_t)c->rows * c->stride * sizeof(mlp_real));
+        if (fused) {
+            gemm_fused(GEMM_NO_TRANS, GEMM_NO_TRANS, shape->m, shape->n, shape->k, 1.0,
+                       a->buffer, a->stride, b->buffer, b->stride, c->buffer, c->stride, &epilogue);
+        } else {
+            gemm(GEMM_NO_TRANS, GEMM_NO_TRANS, shape->m, shape->n, shape->k, 1.0,
+                 a->buffer, a->stride, b->buffer, b->stride, c->buffer, c->stride);
+            for (int i = 0; i < c->rows; i++)
+                kernels->axpy(c->columns, 1.0, bias, matrix_row(c, i));
+            for (int i = 0; i < c->rows; i++)
+                kernels->sigmoid(c->columns, matrix_row(c, i));
+        }
+        reps++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < min_time);
+
+    return elapsed / reps * 1e6;
+}
+
+int
+main(int argc, char* argv[]) {
+    //Backpropagation reads one operand transposed (T), as train_mlp_model() does
+    Shape shapes[] = {
+        {"forward     1x784 * 784x200",    GEMM_NO_TRANS, GEMM_NO_TRANS, 1, 200, 784},
+        {"forward     1x200 * 200x2",      GEMM_NO_TRANS, GEMM_NO_TRANS, 1, 2,   200},
+        {"hidden err  1x2 * (200x2)T",     GEMM_NO_TRANS, GEMM_TRANS,    1, 200, 2},
+        {"delta w     (1x784)T * 1x200",   GEMM_TRANS,    GEMM_NO_TRANS, 784, 200, 1},
+        {"delta w     (1x200)T * 1x2",     GEMM_TRANS,    GEMM_NO_TRANS, 200, 2,   1},
+        {"batch 32    32x784 * 784x200",   GEMM_NO_TRANS, GEMM_NO_TRANS, 32, 200, 784},
+        {"batch 256   256x784 * 784x200",  GEMM_NO_TRANS, GEMM_NO_TRANS, 256, 200, 784},
+        {"err b32     32x200 * (784x200)T", GEMM_NO_TRANS, GEMM_TRANS,   32, 784, 200},
+        {"delta w b32 (32x784)T * 32x200", GEMM_TRANS,    GEMM_NO_TRANS, 784, 200, 32},
+    };
+    double min_time = argc > 1 ? atof(argv[1]) : 0.2;
+
+    srand(1);
+    printf("Kernels: %s (%s), threads: %d\n", simd_kernels()->name, MLP_REAL_NAME, thread_pool_num_threads());
+    printf("%-32s %12s %12s %8s %10s\n", "shape", "naive GF/s", "gemm GF/s", "speedup", "max diff");
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        Matrix a, b, c, ref;
+        if (shapes[s].trans_a)
+            init_matrix(&a, shapes[s].k, shapes[s].m);
+        else
+            init_matrix(&a, shapes[s].m, shapes[s].k);
+        if (shapes[s].trans_b)
+            init_matrix(&b, shapes[s].n, shapes[s].k);
+        else
+            init_matrix(&b, shapes[s].k, shapes[s].n);
+        init_matrix(&c, shapes[s].m, shapes[s].n);
+        init_matrix(&ref, shapes[s].m, shapes[s].n);
+        set_rand_weights(&a);
+        set_rand_weights(&b);
+
+        double naive = time_kernel(1, &shapes[s], &a, &b, &ref, min_time);
+        double fast = time_kernel(0, &shapes[s], &a, &b, &c, min_time);
+
+        //Check the result against the reference loop
+        double max_diff = 0.0;
+        for (int i = 0; i < c.rows; i++) {
+            for (int j = 0; j < c.columns; j++) {
+                double d = fabs(matrix_row(&c, i)[j] - matrix_row(&ref, i)[j]);
+                if (d > max_diff)
+                    max_diff = d;
+            }
+        }
+
+        printf("%-32s %12.3f %12.3f %7.2fx %10.2e\n", shapes[s].name, naive, fast, fast / naive, max_diff);
+        free_matrix(&a);
+        free_matrix(&b);
+        free_matrix(&c);
+        free_matrix(&ref);
+    }
+
+    Shape layers[] = {
+        {"hidden      1x784 * 784x200",    GEMM_NO_TRANS, GEMM_NO_TRANS, 1, 200, 784},
+        {"output      1x200 * 200x2",      GEMM_NO_TRANS, GEMM_NO_TRANS, 1, 2,   200},
+        {"hidden b32  32x784 * 784x200",   GEMM_NO_TRANS, GEMM_NO_TRANS, 32, 200, 784},
+        {"hidden b256 256x784 * 784x200",  GEMM_NO_TRANS, GEMM_NO_TRANS, 256, 200, 784},
+        {"hidden b256 256x200 * 200x200",  GEMM_NO_TRANS, GEMM_NO_TRANS, 256, 200, 200},
+    };
+    printf("\n%-32s %12s %12s %8s %10s\n", "dense layer + bias + sigmoid", "passes us", "fused us", "speedup", "max diff");
+    for (size_t s = 0; s < sizeof(layers) / sizeof(layers[0]); s++) {
+        Matrix a, b, bias, c, ref;
+        init_matrix(&a, layers[s].m, layers[s].k);
+        init_matrix(&b, layers[s].k, layers[s].n);
+        init_matrix(&bias, 1, layers[s].n);
+        init_matrix(&c, layers[s].m, layers[s].n);
+        init_matrix(&ref, layers[s].m, layers[s].n);
+        set_rand_weights(&a);
+        set_rand_weights(&b);
+        set_rand_weights(&bias);
+
+        double passes = time_dense(0, &layers[s], &a, &b, bias.buffer, &ref, min_time);
+        double fused = time_dense(1, &layers[s], &a, &b, bias.buffer, &c, min_time);
+
+        double max_diff = 0.0;
+        for (int i = 0; i < c.rows; i++) {
+            for (int j = 0; j < c.columns; j++) {
+                double d = fabs(matrix_row(&c, i)[j] - matrix_row(&ref, i)[j]);
+                if (d > max_diff)
+                    max_diff = d;
+            }
+        }
+
+        printf("%-32s %12.2f %12.2f %7.2fx %10.2e\n", layers[s].name, passes, fused, passes / fused, max_diff);
+        free_matrix(&a);
+        free_matrix(&b);
+        free_matrix(&bias);
+        free_matrix(&c);
+        free_matrix(&ref);
+    }
+
+    return 0;
+}
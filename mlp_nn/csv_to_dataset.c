@@ -0,0 +1,42 @@
+#include "mlp_nn.h"
+
+//Convert a CSV data set (num_inputs pixels in [0, 1] then one output per class on each row) into
+//the binary data set format of dataset.h, about 1 byte per pixel
+int
+main(int argc, char* argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s <input.csv> <output> <num_inputs> <class name>...\n", argv[0]);
+        return 1;
+    }
+    unsigned int num_inputs = (unsigned int)atoi(argv[3]);
+    unsigned int num_classes = (unsigned int)(argc - 4);
+
+    //Square images when the pixel count allows it, a single row otherwise
+    unsigned int width = (unsigned int)sqrt((double)num_inputs);
+    while (width * width < num_inputs)
+        width++;
+    unsigned int height = width;
+    if (width * height != num_inputs) {
+        width = num_inputs;
+        height = 1;
+    }
+
+    Matrix input_nodes;
+    Matrix output_nodes;
+    if (num_inputs == 0 || !read_dataset(argv[1], num_inputs, num_classes, &input_nodes, &output_nodes))
+        return 1;
+
+    Dataset dataset;
+    int converted = dataset_from_matricies(&dataset, &input_nodes, &output_nodes, width, height, (const char* const*)(argv + 4));
+    free_matrix(&input_nodes);
+    free_matrix(&output_nodes);
+    if (!converted)
+        return 1;
+
+    int saved = save_binary_dataset(argv[2], &dataset);
+    if (saved)
+        printf("Wrote %u samples of %u x %u pixels and %u classes to %s\n",
+               dataset.num_samples, width, height, num_classes, argv[2]);
+    free_dataset(&dataset);
+    return saved ? 0 : 1;
+}
@@ -0,0 +1,1334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dataset.h"
+#include "log.h"
+#include "thread_pool.h"
+
+//Longest number handed to strtod() (it needs a NUL terminated copy, the mapping has none)
+#define MAX_NUMBER_LENGTH 128
+
+int
+map_file(const char* file_path, MappedFile* file) {
+    file->data = NULL;
+    file->size = 0;
+
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        mlp_log(MLP_LOG_ERROR, "Cannot read file %s", file_path);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        mlp_log(MLP_LOG_ERROR, "Cannot get the size of %s", file_path);
+        close(fd);
+        return 0;
+    }
+    if (st.st_size == 0) {
+        //Nothing to map (mmap() rejects empty mappings)
+        close(fd);
+        return 1;
+    }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //The mapping keeps its own reference to the file
+    close(fd);
+    if (data == MAP_FAILED) {
+        mlp_log(MLP_LOG_ERROR, "Cannot map file %s", file_path);
+        return 0;
+    }
+    //The parsers walk the file front to back, let the kernel read ahead aggressively
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    file->data = (const char*)data;
+    file->size = (size_t)st.st_size;
+    return 1;
+}
+
+void
+unmap_file(MappedFile* file) {
+    if (file->data != NULL)
+        munmap((void*)file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+
+//Powers of ten that a double holds exactly
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#define MAX_EXACT_POWER 22
+//Integers up to 2^53 convert to double exactly
+#define MAX_EXACT_MANTISSA (1ull << 53)
+
+static inline int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+const char*
+parse_real(const char* p, const char* end, double* value) {
+    const char* start = p;
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    //Up to 19 significant digits fit the mantissa, more are dropped (which rules out the fast path)
+    uint64_t mantissa = 0;
+    int significant = 0, digits = 0, exponent = 0, truncated = 0;
+    for (; p < end && is_digit(*p); p++, digits++) {
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            significant += mantissa != 0;
+        } else {
+            exponent++;
+            truncated = 1;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++, digits++) {
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                significant += mantissa != 0;
+                exponent--;
+            } else {
+                truncated = 1;
+            }
+        }
+    }
+
+    if (digits == 0) {
+        //Not a plain decimal number, strtod() still knows about inf and nan
+        if (p == end || (*p != 'i' && *p != 'I' && *p != 'n' && *p != 'N'))
+            return NULL;
+        truncated = 1;
+    } else if (p < end && (*p == 'e' || *p == 'E')) {
+        //The exponent only belongs to the number when it has digits
+        const char* e = p + 1;
+        int exp_negative = 0;
+        if (e < end && (*e == '-' || *e == '+')) {
+            exp_negative = *e == '-';
+            e++;
+        }
+        if (e < end && is_digit(*e)) {
+            int exp_value = 0;
+            for (; e < end && is_digit(*e); e++) {
+                if (exp_value < 100000)
+                    exp_value = exp_value * 10 + (*e - '0');
+            }
+            exponent += exp_negative ? -exp_value : exp_value;
+            p = e;
+        }
+    }
+
+    //Clinger's fast path: an exactly representable mantissa times (or over) an exactly
+    //representable power of ten is correctly rounded by a single IEEE operation
+    if (!truncated && mantissa <= MAX_EXACT_MANTISSA && exponent >= -MAX_EXACT_POWER && exponent <= MAX_EXACT_POWER) {
+        double v = (double)mantissa;
+        v = exponent < 0 ? v / exact_powers_of_ten[-exponent] : v * exact_powers_of_ten[exponent];
+        *value = negative ? -v : v;
+        return p;
+    }
+    if (mantissa == 0 && !truncated) {
+        *value = negative ? -0.0 : 0.0;
+        return p;
+    }
+
+    //Slow path, strtod() on a terminated copy of the rest of the token
+    char number[MAX_NUMBER_LENGTH];
+    size_t length = 0;
+    for (const char* q = start; q < end && length < MAX_NUMBER_LENGTH - 1 && *q != ',' && *q != '\n'; q++)
+        number[length++] = *q;
+    number[length] = '\0';
+    char* number_end;
+    *value = strtod(number, &number_end);
+    if (number_end == number)
+        return NULL;
+    return start + (number_end - number);
+}
+
+int
+csv_count_rows(const char* data, size_t size) {
+    int rows = 0;
+    const char* p = data;
+    const char* end = data + size;
+    const char* newline;
+    while (p < end && (newline = (const char*)memchr(p, '\n', end - p)) != NULL) {
+        rows++;
+        p = newline + 1;
+    }
+    //Last line without a newline
+    if (p < end)
+        rows++;
+    return rows;
+}
+
+static inline int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+//Print the line with the value that could not be parsed
+static void report_bad_value(const char* p, const char* line_end, int row) {
+    int length = (int)(line_end - p) < 32 ? (int)(line_end - p) : 32;
+    mlp_log(MLP_LOG_ERROR, "No valid digits were found in \"%.*s\" (row %d)", length, p, row);
+}
+
+int
+parse_csv_rows(const char* data, size_t size, int first_row, int rows, unsigned int num_inputs, unsigned int num_outputs,
+               Matrix* input_nodes, Matrix* output_nodes) {
+    const char* p = data;
+    const char* end = data + size;
+    unsigned int num_values = num_inputs + num_outputs;
+    for (int row = first_row; row < first_row + rows && p < end; row++) {
+        const char* line_end = (const char*)memchr(p, '\n', end - p);
+        if (line_end == NULL)
+            line_end = end;
+
+        mlp_real* inputs = matrix_row(input_nodes, row);
+        mlp_real* outputs = matrix_row(output_nodes, row);
+        unsigned int i = 0;
+        while (i < num_values) {
+            //Empty fields and blanks around values are skipped
+            while (p < line_end && (is_blank(*p) || *p == ','))
+                p++;
+            if (p == line_end)
+                break;
+
+            double value;
+            const char* next = parse_real(p, line_end, &value);
+            if (next == NULL) {
+                report_bad_value(p, line_end, row);
+                return 0;
+            }
+            if (i < num_inputs)
+                inputs[i] = (mlp_real)value;
+            else
+                outputs[i - num_inputs] = (mlp_real)value;
+            i++;
+
+            //Only blanks may follow a value inside its field
+            p = next;
+            while (p < line_end && is_blank(*p))
+                p++;
+            if (p < line_end && *p != ',') {
+                report_bad_value(next, line_end, row);
+                return 0;
+            }
+        }
+        p = line_end + 1;
+    }
+    return 1;
+}
+
+//A piece of the file that starts at the beginning of a line and ends right after a newline (or at
+//the end of the file)
+typedef struct {
+    const char* begin;
+    const char* end;
+    int first_row;
+    int rows;
+    int failed;
+} CsvChunk;
+
+typedef struct {
+    CsvChunk* chunks;
+    unsigned int num_inputs;
+    unsigned int num_outputs;
+    Matrix* input_nodes;
+    Matrix* output_nodes;
+} CsvJob;
+
+static void count_chunk_task(void* ctx, int task) {
+    CsvChunk* chunk = &((CsvJob*)ctx)->chunks[task];
+    chunk->rows = csv_count_rows(chunk->begin, chunk->end - chunk->begin);
+}
+
+static void parse_chunk_task(void* ctx, int task) {
+    CsvJob* job = (CsvJob*)ctx;
+    CsvChunk* chunk = &job->chunks[task];
+    chunk->failed = !parse_csv_rows(chunk->begin, chunk->end - chunk->begin, chunk->first_row, chunk->rows,
+                                    job->num_inputs, job->num_outputs, job->input_nodes, job->output_nodes);
+}
+
+int
+load_csv_dataset(const char* data, size_t size, unsigned int num_inputs, unsigned int num_outputs,
+                 Matrix* input_nodes, Matrix* output_nodes) {
+    //A few chunks per thread to even out the load, but not so small the task overhead shows
+    int threads = thread_pool_num_threads();
+    size_t chunk_size = size / ((size_t)threads * CSV_CHUNKS_PER_THREAD) + 1;
+    if (chunk_size < CSV_MIN_CHUNK_SIZE)
+        chunk_size = CSV_MIN_CHUNK_SIZE;
+    int max_chunks = (int)(size / chunk_size) + 1;
+
+    CsvChunk* chunks = (CsvChunk*)malloc(max_chunks * sizeof(CsvChunk));
+    if (chunks == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate the data set chunks");
+        return 0;
+    }
+
+    //Cut the file roughly every chunk_size bytes, moving each cut past the next newline
+    int num_chunks = 0;
+    const char* end = data + size;
+    const char* p = data;
+    while (p < end) {
+        const char* cut = (size_t)(end - p) > chunk_size ? p + chunk_size : end;
+        if (cut < end) {
+            const char* newline = (const char*)memchr(cut, '\n', end - cut);
+            cut = newline != NULL ? newline + 1 : end;
+        }
+        chunks[num_chunks].begin = p;
+        chunks[num_chunks].end = cut;
+        chunks[num_chunks].failed = 0;
+        num_chunks++;
+        p = cut;
+    }
+
+    //Count the rows of every chunk in parallel, their running sum gives the first row of each
+    CsvJob job = {chunks, num_inputs, num_outputs, input_nodes, output_nodes};
+    thread_pool_run(num_chunks, count_chunk_task, &job);
+    int rows = 0;
+    for (int c = 0; c < num_chunks; c++) {
+        chunks[c].first_row = rows;
+        rows += chunks[c].rows;
+    }
+    if (rows == 0) {
+        mlp_log(MLP_LOG_ERROR, "Data set is empty");
+        free(chunks);
+        return 0;
+    }
+
+    //Parse the chunks in parallel straight into their rows of the matricies
+    init_matrix(input_nodes, rows, num_inputs);
+    init_matrix(output_nodes, rows, num_outputs);
+    thread_pool_run(num_chunks, parse_chunk_task, &job);
+
+    int failed = 0;
+    for (int c = 0; c < num_chunks; c++)
+        failed |= chunks[c].failed;
+    free(chunks);
+    if (failed) {
+        free_matrix(input_nodes);
+        free_matrix(output_nodes);
+        return 0;
+    }
+    return rows;
+}
+
+//== Binary data sets ==
+
+static void put_u32(unsigned char* p, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64(unsigned char* p, uint64_t v) {
+    for (int i = 0; i < 8; i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(const unsigned char* p) {
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT * DATASET_ALIGNMENT;
+}
+
+int
+is_binary_dataset(const char* file_path) {
+    char magic[4];
+    FILE* file = fopen(file_path, "rb");
+    if (file == NULL)
+        return 0;
+    int is_binary = fread(magic, 1, 4, file) == 4 && memcmp(magic, DATASET_MAGIC, 4) == 0;
+    fclose(file);
+    return is_binary;
+}
+
+//Split the names block into num_classes strings, returns 0 when it does not hold that many
+static int split_class_names(Dataset* dataset, size_t names_size) {
+    dataset->class_names = (char**)malloc((dataset->num_classes > 0 ? dataset->num_classes : 1) * sizeof(char*));
+    if (dataset->class_names == NULL)
+        return 0;
+    size_t offset = 0;
+    for (unsigned int c = 0; c < dataset->num_classes; c++) {
+        const char* name_end = offset < names_size ? (const char*)memchr(dataset->names_block + offset, '\0', names_size - offset) : NULL;
+        if (name_end == NULL)
+            return 0;
+        dataset->class_names[c] = dataset->names_block + offset;
+        offset = name_end - dataset->names_block + 1;
+    }
+    return 1;
+}
+
+//Check the header and fill the shape of the data set in, returns 0 when it is not valid
+static int read_dataset_header(const unsigned char* header, uint64_t file_size, Dataset* dataset,
+                               size_t* names_size, uint64_t* pixels_offset, uint64_t* labels_offset) {
+    if (memcmp(header, DATASET_MAGIC, 4) != 0) {
+        mlp_log(MLP_LOG_ERROR, "Not a binary data set");
+        return 0;
+    }
+    if (get_u32(header + 4) != DATASET_VERSION) {
+        mlp_log(MLP_LOG_ERROR, "Unsupported data set version %u", get_u32(header + 4));
+        return 0;
+    }
+    dataset->num_samples = get_u32(header + 8);
+    dataset->num_inputs = get_u32(header + 12);
+    dataset->width = get_u32(header + 16);
+    dataset->height = get_u32(header + 20);
+    dataset->num_classes = get_u32(header + 24);
+    *names_size = get_u32(header + 28);
+    *pixels_offset = get_u64(header + 32);
+    *labels_offset = get_u64(header + 40);
+
+    uint64_t pixels_size = (uint64_t)dataset->num_samples * dataset->num_inputs;
+    if (*pixels_offset < DATASET_HEADER_SIZE + *names_size || *pixels_offset + pixels_size > file_size ||
+        *labels_offset < *pixels_offset + pixels_size || *labels_offset + 2 * (uint64_t)dataset->num_samples > file_size ||
+        (uint64_t)dataset->width * dataset->height != dataset->num_inputs) {
+        mlp_log(MLP_LOG_ERROR, "Data set header does not match the file");
+        return 0;
+    }
+    return 1;
+}
+
+//Labels are u16 little endian on disk, decoded in place
+static int decode_labels(Dataset* dataset) {
+    const unsigned char* bytes = (const unsigned char*)dataset->labels;
+    for (unsigned int i = 0; i < dataset->num_samples; i++) {
+        dataset->labels[i] = (uint16_t)(bytes[2 * i] | bytes[2 * i + 1] << 8);
+        if (dataset->labels[i] >= dataset->num_classes) {
+            mlp_log(MLP_LOG_ERROR, "Sample %u has label %u but there are %u classes",
+                    i, dataset->labels[i], dataset->num_classes);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int
+load_binary_dataset(const char* file_path, Dataset* dataset) {
+    memset(dataset, 0, sizeof(Dataset));
+    FILE* file = fopen(file_path, "rb");
+    if (file == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot read file %s", file_path);
+        return 0;
+    }
+
+    unsigned char header[DATASET_HEADER_SIZE];
+    size_t names_size;
+    uint64_t pixels_offset, labels_offset;
+    fseek(file, 0, SEEK_END);
+    uint64_t file_size = (uint64_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (fread(header, 1, DATASET_HEADER_SIZE, file) != DATASET_HEADER_SIZE ||
+        !read_dataset_header(header, file_size, dataset, &names_size, &pixels_offset, &labels_offset)) {
+        mlp_log(MLP_LOG_ERROR, "Cannot load data set %s", file_path);
+        fclose(file);
+        return 0;
+    }
+
+    size_t pixels_size = (size_t)dataset->num_samples * dataset->num_inputs;
+    void* pixels = NULL;
+    dataset->names_block = (char*)malloc(names_size + 1);
+    dataset->labels = (uint16_t*)malloc(((size_t)dataset->num_samples + 1) * sizeof(uint16_t));
+    if (posix_memalign(&pixels, DATASET_ALIGNMENT, pixels_size + 1) != 0)
+        pixels = NULL;
+    dataset->pixels = (uint8_t*)pixels;
+
+    int loaded = dataset->names_block != NULL && dataset->labels != NULL && dataset->pixels != NULL &&
+                 fread(dataset->names_block, 1, names_size, file) == names_size &&
+                 split_class_names(dataset, names_size) &&
+                 fseek(file, (long)pixels_offset, SEEK_SET) == 0 &&
+                 fread(dataset->pixels, 1, pixels_size, file) == pixels_size &&
+                 fseek(file, (long)labels_offset, SEEK_SET) == 0 &&
+                 fread(dataset->labels, 2, dataset->num_samples, file) == dataset->num_samples &&
+                 decode_labels(dataset);
+    fclose(file);
+    if (!loaded) {
+        mlp_log(MLP_LOG_ERROR, "Cannot load data set %s", file_path);
+        free_dataset(dataset);
+        return 0;
+    }
+    return 1;
+}
+
+int
+map_binary_dataset(const char* file_path, Dataset* dataset) {
+    memset(dataset, 0, sizeof(Dataset));
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    //The labels need byte swapping, which a read only mapping cannot do
+    return load_binary_dataset(file_path, dataset);
+#endif
+    if (!map_file(file_path, &dataset->mapping))
+        return 0;
+
+    size_t names_size;
+    uint64_t pixels_offset, labels_offset;
+    const unsigned char* data = (const unsigned char*)dataset->mapping.data;
+    if (dataset->mapping.size < DATASET_HEADER_SIZE ||
+        !read_dataset_header(data, dataset->mapping.size, dataset, &names_size, &pixels_offset, &labels_offset) ||
+        labels_offset % sizeof(uint16_t) != 0) {
+        mlp_log(MLP_LOG_ERROR, "Cannot map data set %s", file_path);
+        free_dataset(dataset);
+        return 0;
+    }
+    madvise((void*)dataset->mapping.data, dataset->mapping.size, MADV_RANDOM);
+
+    //The mapping is read only, nothing writes through these
+    dataset->names_block = (char*)(data + DATASET_HEADER_SIZE);
+    dataset->pixels = (uint8_t*)(data + pixels_offset);
+    dataset->labels = (uint16_t*)(data + labels_offset);
+    int valid = split_class_names(dataset, names_size);
+    for (unsigned int i = 0; valid && i < dataset->num_samples; i++) {
+        if (dataset->labels[i] >= dataset->num_classes) {
+            mlp_log(MLP_LOG_ERROR, "Sample %u has label %u but there are %u classes",
+                    i, dataset->labels[i], dataset->num_classes);
+            valid = 0;
+        }
+    }
+    if (!valid) {
+        mlp_log(MLP_LOG_ERROR, "Cannot map data set %s", file_path);
+        free_dataset(dataset);
+        return 0;
+    }
+    return 1;
+}
+
+int
+save_binary_dataset(const char* file_path, const Dataset* dataset) {
+    FILE* file = fopen(file_path, "wb");
+    if (file == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot write to file %s", file_path);
+        return 0;
+    }
+
+    size_t names_size = 0;
+    for (unsigned int c = 0; c < dataset->num_classes; c++)
+        names_size += strlen(dataset->class_names[c]) + 1;
+    size_t pixels_size = (size_t)dataset->num_samples * dataset->num_inputs;
+    uint64_t pixels_offset = align_offset(DATASET_HEADER_SIZE + names_size);
+    uint64_t labels_offset = align_offset(pixels_offset + pixels_size);
+
+    unsigned char header[DATASET_HEADER_SIZE];
+    memcpy(header, DATASET_MAGIC, 4);
+    put_u32(header + 4, DATASET_VERSION);
+    put_u32(header + 8, dataset->num_samples);
+    put_u32(header + 12, dataset->num_inputs);
+    put_u32(header + 16, dataset->width);
+    put_u32(header + 20, dataset->height);
+    put_u32(header + 24, dataset->num_classes);
+    put_u32(header + 28, (uint32_t)names_size);
+    put_u64(header + 32, pixels_offset);
+    put_u64(header + 40, labels_offset);
+
+    static const unsigned char padding[DATASET_ALIGNMENT] = {0};
+    int written = fwrite(header, 1, DATASET_HEADER_SIZE, file) == DATASET_HEADER_SIZE;
+    for (unsigned int c = 0; c < dataset->num_classes && written; c++)
+        written = fwrite(dataset->class_names[c], 1, strlen(dataset->class_names[c]) + 1, file) > 0;
+    written = written && fwrite(padding, 1, pixels_offset - DATASET_HEADER_SIZE - names_size, file) == pixels_offset - DATASET_HEADER_SIZE - names_size;
+    written = written && fwrite(dataset->pixels, 1, pixels_size, file) == pixels_size;
+    written = written && fwrite(padding, 1, labels_offset - pixels_offset - pixels_size, file) == labels_offset - pixels_offset - pixels_size;
+    for (unsigned int i = 0; i < dataset->num_samples && written; i++) {
+        unsigned char label[2] = {(unsigned char)(dataset->labels[i] & 0xff), (unsigned char)(dataset->labels[i] >> 8)};
+        written = fwrite(label, 1, 2, file) == 2;
+    }
+
+    if (fclose(file) != 0 || !written) {
+        mlp_log(MLP_LOG_ERROR, "Cannot write data set %s", file_path);
+        return 0;
+    }
+    return 1;
+}
+
+void
+dataset_fetch(const Dataset* dataset, int sample, mlp_real* inputs, mlp_real* outputs) {
+    const uint8_t* pixels = dataset_pixels(dataset, sample);
+    const mlp_real scale = (mlp_real)(1.0 / 255.0);
+    for (unsigned int j = 0; j < dataset->num_inputs; j++)
+        inputs[j] = pixels[j] * scale;
+    for (unsigned int c = 0; c < dataset->num_classes; c++)
+        outputs[c] = c == dataset->labels[sample] ? 1 : 0;
+}
+
+int
+dataset_from_matricies(Dataset* dataset, Matrix* input_nodes, Matrix* output_nodes,
+                       unsigned int width, unsigned int height, const char* const* class_names) {
+    memset(dataset, 0, sizeof(Dataset));
+    if ((uint64_t)width * height != (uint64_t)input_nodes->columns || output_nodes->rows != input_nodes->rows ||
+        output_nodes->columns <= 0 || output_nodes->columns > UINT16_MAX) {
+        mlp_log(MLP_LOG_ERROR, "Cannot build a %u x %u data set from %d inputs and %d outputs",
+                width, height, input_nodes->columns, output_nodes->columns);
+        return 0;
+    }
+    dataset->num_samples = input_nodes->rows;
+    dataset->num_inputs = input_nodes->columns;
+    dataset->width = width;
+    dataset->height = height;
+    dataset->num_classes = output_nodes->columns;
+
+    //Class names, generated when not given
+    size_t names_size = 0;
+    char generated[32];
+    for (unsigned int c = 0; c < dataset->num_classes; c++)
+        names_size += (class_names != NULL ? strlen(class_names[c]) : (size_t)snprintf(generated, sizeof(generated), "class%u", c)) + 1;
+    dataset->names_block = (char*)malloc(names_size);
+    void* pixels = NULL;
+    if (posix_memalign(&pixels, DATASET_ALIGNMENT, (size_t)dataset->num_samples * dataset->num_inputs + 1) != 0)
+        pixels = NULL;
+    dataset->pixels = (uint8_t*)pixels;
+    dataset->labels = (uint16_t*)malloc(((size_t)dataset->num_samples + 1) * sizeof(uint16_t));
+    if (dataset->names_block == NULL || dataset->pixels == NULL || dataset->labels == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate the data set");
+        free_dataset(dataset);
+        return 0;
+    }
+    size_t offset = 0;
+    for (unsigned int c = 0; c < dataset->num_classes; c++) {
+        if (class_names != NULL)
+            offset += sprintf(dataset->names_block + offset, "%s", class_names[c]) + 1;
+        else
+            offset += sprintf(dataset->names_block + offset, "class%u", c) + 1;
+    }
+    split_class_names(dataset, names_size);
+
+    //Pixels were written as value / 255, rounding back recovers the byte
+    size_t clamped = 0;
+    for (unsigned int i = 0; i < dataset->num_samples; i++) {
+        const mlp_real* in = matrix_row(input_nodes, i);
+        uint8_t* px = dataset->pixels + (size_t)i * dataset->num_inputs;
+        for (unsigned int j = 0; j < dataset->num_inputs; j++) {
+            double v = in[j];
+            if (v < 0.0 || v > 1.0) {
+                v = v < 0.0 ? 0.0 : 1.0;
+                clamped++;
+            }
+            px[j] = (uint8_t)(v * 255.0 + 0.5);
+        }
+
+        const mlp_real* out = matrix_row(output_nodes, i);
+        unsigned int label = 0;
+        for (unsigned int c = 1; c < dataset->num_classes; c++) {
+            if (out[c] > out[label])
+                label = c;
+        }
+        dataset->labels[i] = (uint16_t)label;
+    }
+    if (clamped > 0)
+        mlp_log(MLP_LOG_WARN, "%zu inputs outside [0, 1] were clamped", clamped);
+    return 1;
+}
+
+//== Row index of CSV data sets ==
+
+//Class of a CSV row: the largest of its last num_classes values (DATASET_NO_LABEL without them)
+static uint16_t row_label(const char* line, const char* line_end, unsigned int num_classes) {
+    if (num_classes == 0 || num_classes >= DATASET_NO_LABEL)
+        return DATASET_NO_LABEL;
+    //Back over num_classes fields to the first output
+    const char* p = line_end;
+    unsigned int commas = 0;
+    while (p > line && !(p[-1] == ',' && ++commas == num_classes))
+        p--;
+    if (p == line && commas + 1 < num_classes)
+        return DATASET_NO_LABEL;
+
+    unsigned int label = 0;
+    double best = 0.0;
+    for (unsigned int c = 0; c < num_classes; c++) {
+        while (p < line_end && (is_blank(*p) || *p == ','))
+            p++;
+        double value;
+        p = parse_real(p, line_end, &value);
+        if (p == NULL)
+            return DATASET_NO_LABEL;
+        if (c == 0 || value > best) {
+            label = c;
+            best = value;
+        }
+    }
+    return (uint16_t)label;
+}
+
+//Sort the rows by class (counts and per class row lists), returns 0 on failure
+static int index_classes(DatasetIndex* index) {
+    index->class_counts = (int*)calloc(index->num_classes + 1, sizeof(int));
+    index->class_rows = (int**)malloc((index->num_classes + 1) * sizeof(int*));
+    index->class_block = (int*)malloc(((size_t)index->num_rows + 1) * sizeof(int));
+    if (index->class_counts == NULL || index->class_rows == NULL || index->class_block == NULL)
+        return 0;
+
+    for (int r = 0; r < index->num_rows; r++) {
+        if (index->rows[r].label < index->num_classes)
+            index->class_counts[index->rows[r].label]++;
+    }
+    int start = 0;
+    for (unsigned int c = 0; c < index->num_classes; c++) {
+        index->class_rows[c] = index->class_block + start;
+        start += index->class_counts[c];
+        index->class_counts[c] = 0;
+    }
+    for (int r = 0; r < index->num_rows; r++) {
+        unsigned int label = index->rows[r].label;
+        if (label < index->num_classes)
+            index->class_rows[label][index->class_counts[label]++] = r;
+    }
+    return 1;
+}
+
+int
+build_dataset_index(const char* data, size_t size, unsigned int num_classes, DatasetIndex* index) {
+    memset(index, 0, sizeof(DatasetIndex));
+    index->data_size = size;
+    index->num_classes = num_classes;
+    index->num_rows = csv_count_rows(data, size);
+    index->rows = (DatasetIndexRow*)malloc(((size_t)index->num_rows + 1) * sizeof(DatasetIndexRow));
+    if (index->rows == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate the data set index");
+        return 0;
+    }
+
+    const char* p = data;
+    const char* end = data + size;
+    for (int r = 0; r < index->num_rows; r++) {
+        const char* line_end = (const char*)memchr(p, '\n', end - p);
+        if (line_end == NULL)
+            line_end = end;
+        index->rows[r].offset = (uint64_t)(p - data);
+        index->rows[r].length = (uint32_t)(line_end - p);
+        index->rows[r].label = row_label(p, line_end, num_classes);
+        p = line_end + 1;
+    }
+
+    if (!index_classes(index)) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate the data set index");
+        free_dataset_index(index);
+        return 0;
+    }
+    return 1;
+}
+
+//Path of the index of a data set file (to be freed)
+static char* dataset_index_path(const char* file_path) {
+    char* path = (char*)malloc(strlen(file_path) + sizeof(DATASET_INDEX_SUFFIX));
+    if (path != NULL)
+        sprintf(path, "%s%s", file_path, DATASET_INDEX_SUFFIX);
+    return path;
+}
+
+//Does the index header describe a data set of data_size bytes with num_classes classes
+static int index_header_matches(const unsigned char* header, uint64_t data_size, unsigned int num_classes) {
+    return memcmp(header, DATASET_INDEX_MAGIC, 4) == 0 && get_u32(header + 4) == DATASET_INDEX_VERSION &&
+           get_u32(header + 8) == num_classes && get_u64(header + 16) == data_size && get_u64(header + 24) < INT32_MAX;
+}
+
+//Read the index file of a data set of data_size bytes, returns 0 when it is missing or stale
+static int read_dataset_index(const char* index_path, uint64_t data_size, unsigned int num_classes, DatasetIndex* index) {
+    memset(index, 0, sizeof(DatasetIndex));
+    FILE* file = fopen(index_path, "rb");
+    if (file == NULL)
+        return 0;
+
+    unsigned char header[DATASET_INDEX_HEADER_SIZE];
+    unsigned char* records = NULL;
+    int loaded = fread(header, 1, DATASET_INDEX_HEADER_SIZE, file) == DATASET_INDEX_HEADER_SIZE &&
+                 index_header_matches(header, data_size, num_classes);
+    if (loaded) {
+        index->data_size = data_size;
+        index->num_classes = num_classes;
+        index->num_rows = (int)get_u64(header + 24);
+        size_t records_size = (size_t)index->num_rows * DATASET_INDEX_RECORD_SIZE;
+        records = (unsigned char*)malloc(records_size + 1);
+        index->rows = (DatasetIndexRow*)malloc(((size_t)index->num_rows + 1) * sizeof(DatasetIndexRow));
+        //The class counts are rebuilt from the records
+        loaded = records != NULL && index->rows != NULL &&
+                 fseek(file, DATASET_INDEX_HEADER_SIZE + 8 * (long)num_classes, SEEK_SET) == 0 &&
+                 fread(records, 1, records_size, file) == records_size;
+    }
+    fclose(file);
+
+    for (int r = 0; loaded && r < index->num_rows; r++) {
+        const unsigned char* record = records + (size_t)r * DATASET_INDEX_RECORD_SIZE;
+        index->rows[r].offset = get_u64(record);
+        index->rows[r].length = get_u32(record + 8);
+        index->rows[r].label = (uint16_t)(record[12] | record[13] << 8);
+        loaded = index->rows[r].offset + index->rows[r].length <= data_size;
+    }
+    free(records);
+    if (!loaded || !index_classes(index)) {
+        free_dataset_index(index);
+        return 0;
+    }
+    return 1;
+}
+
+int
+load_dataset_index(const char* file_path, unsigned int num_classes, DatasetIndex* index) {
+    struct stat st;
+    char* index_path = dataset_index_path(file_path);
+    if (index_path == NULL || stat(file_path, &st) != 0) {
+        mlp_log(MLP_LOG_ERROR, "Cannot read file %s", file_path);
+        free(index_path);
+        return 0;
+    }
+    int loaded = read_dataset_index(index_path, (uint64_t)st.st_size, num_classes, index);
+    free(index_path);
+    if (loaded)
+        return 1;
+
+    //Missing or stale, index the data set again
+    MappedFile file;
+    if (!map_file(file_path, &file))
+        return 0;
+    loaded = build_dataset_index(file.data, file.size, num_classes, index);
+    unmap_file(&file);
+    if (loaded)
+        save_dataset_index(file_path, index);
+    return loaded;
+}
+
+int
+save_dataset_index(const char* file_path, const DatasetIndex* index) {
+    char* index_path = dataset_index_path(file_path);
+    FILE* file = index_path != NULL ? fopen(index_path, "wb") : NULL;
+    if (file == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot write the index of %s", file_path);
+        free(index_path);
+        return 0;
+    }
+
+    unsigned char header[DATASET_INDEX_HEADER_SIZE];
+    memcpy(header, DATASET_INDEX_MAGIC, 4);
+    put_u32(header + 4, DATASET_INDEX_VERSION);
+    put_u32(header + 8, index->num_classes);
+    put_u32(header + 12, 0);
+    put_u64(header + 16, index->data_size);
+    put_u64(header + 24, (uint64_t)index->num_rows);
+    int written = fwrite(header, 1, DATASET_INDEX_HEADER_SIZE, file) == DATASET_INDEX_HEADER_SIZE;
+    for (unsigned int c = 0; c < index->num_classes && written; c++) {
+        unsigned char count[8];
+        put_u64(count, (uint64_t)index->class_counts[c]);
+        written = fwrite(count, 1, 8, file) == 8;
+    }
+    for (int r = 0; r < index->num_rows && written; r++) {
+        unsigned char record[DATASET_INDEX_RECORD_SIZE] = {0};
+        put_u64(record, index->rows[r].offset);
+        put_u32(record + 8, index->rows[r].length);
+        record[12] = (unsigned char)(index->rows[r].label & 0xff);
+        record[13] = (unsigned char)(index->rows[r].label >> 8);
+        written = fwrite(record, 1, DATASET_INDEX_RECORD_SIZE, file) == DATASET_INDEX_RECORD_SIZE;
+    }
+
+    if (fclose(file) != 0 || !written) {
+        mlp_log(MLP_LOG_ERROR, "Cannot write the index of %s", file_path);
+        remove(index_path);
+        free(index_path);
+        return 0;
+    }
+    free(index_path);
+    return 1;
+}
+
+int
+append_dataset_index(const char* file_path, uint64_t data_size, uint64_t offset, uint32_t length,
+                     unsigned int label, unsigned int num_classes) {
+    struct stat st;
+    char* index_path = dataset_index_path(file_path);
+    if (index_path == NULL || stat(file_path, &st) != 0) {
+        free(index_path);
+        return 0;
+    }
+    FILE* file = fopen(index_path, "r+b");
+    free(index_path);
+
+    unsigned char header[DATASET_INDEX_HEADER_SIZE];
+    if (file == NULL || fread(header, 1, DATASET_INDEX_HEADER_SIZE, file) != DATASET_INDEX_HEADER_SIZE ||
+        !index_header_matches(header, data_size, num_classes)) {
+        if (file != NULL)
+            fclose(file);
+        //The index was not up to date, the rebuilt one already has the new row
+        DatasetIndex index;
+        if (!load_dataset_index(file_path, num_classes, &index))
+            return 0;
+        free_dataset_index(&index);
+        return 1;
+    }
+
+    //The record goes first so an interrupted append leaves a valid (stale) index
+    uint64_t num_rows = get_u64(header + 24);
+    unsigned char record[DATASET_INDEX_RECORD_SIZE] = {0};
+    uint16_t row_label = label < num_classes ? (uint16_t)label : DATASET_NO_LABEL;
+    put_u64(record, offset);
+    put_u32(record + 8, length);
+    record[12] = (unsigned char)(row_label & 0xff);
+    record[13] = (unsigned char)(row_label >> 8);
+    long records_start = DATASET_INDEX_HEADER_SIZE + 8 * (long)num_classes;
+    int written = fseek(file, records_start + (long)num_rows * DATASET_INDEX_RECORD_SIZE, SEEK_SET) == 0 &&
+                  fwrite(record, 1, DATASET_INDEX_RECORD_SIZE, file) == DATASET_INDEX_RECORD_SIZE;
+
+    if (written && row_label != DATASET_NO_LABEL) {
+        unsigned char count[8];
+        written = fseek(file, DATASET_INDEX_HEADER_SIZE + 8 * (long)row_label, SEEK_SET) == 0 &&
+                  fread(count, 1, 8, file) == 8;
+        put_u64(count, get_u64(count) + 1);
+        written = written && fseek(file, DATASET_INDEX_HEADER_SIZE + 8 * (long)row_label, SEEK_SET) == 0 &&
+                  fwrite(count, 1, 8, file) == 8;
+    }
+    put_u64(header + 16, (uint64_t)st.st_size);
+    put_u64(header + 24, num_rows + 1);
+    written = written && fseek(file, 0, SEEK_SET) == 0 &&
+              fwrite(header, 1, DATASET_INDEX_HEADER_SIZE, file) == DATASET_INDEX_HEADER_SIZE;
+    if (fclose(file) != 0 || !written) {
+        mlp_log(MLP_LOG_ERROR, "Cannot update the index of %s", file_path);
+        return 0;
+    }
+    return 1;
+}
+
+int
+parse_indexed_rows(const char* data, const DatasetIndex* index, const int* row_numbers, int rows,
+                   unsigned int num_inputs, unsigned int num_outputs, Matrix* input_nodes, Matrix* output_nodes) {
+    for (int i = 0; i < rows; i++) {
+        if (row_numbers[i] < 0 || row_numbers[i] >= index->num_rows) {
+            mlp_log(MLP_LOG_ERROR, "Row %d is not in the index (%d rows)", row_numbers[i], index->num_rows);
+            return 0;
+        }
+        const DatasetIndexRow* row = &index->rows[row_numbers[i]];
+        if (!parse_csv_rows(data + row->offset, row->length, i, 1, num_inputs, num_outputs, input_nodes, output_nodes))
+            return 0;
+    }
+    return 1;
+}
+
+void
+free_dataset_index(DatasetIndex* index) {
+    free(index->rows);
+    free(index->class_counts);
+    free(index->class_rows);
+    free(index->class_block);
+    memset(index, 0, sizeof(DatasetIndex));
+}
+
+//== Sample hashes ==
+
+static uint64_t mix_u64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t
+sample_hash(const uint8_t* pixels, size_t count) {
+    //Eight pixels per multiply, the bytes are read little endian so hashes match across hosts
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ (count * 0xc2b2ae3d27d4eb4full);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint64_t k = get_u64(pixels + i) * 0x87c37b91114253d5ull;
+        h ^= (k << 31 | k >> 33) * 0x4cf5ad432745937full;
+        h = (h << 27 | h >> 37) * 5 + 0x52dce729;
+    }
+    uint64_t k = 0;
+    for (size_t j = 0; i + j < count; j++)
+        k |= (uint64_t)pixels[i + j] << (8 * j);
+    h ^= mix_u64(k);
+    h = mix_u64(h);
+    //0 marks the empty slots
+    return h != 0 ? h : 1;
+}
+
+uint64_t
+csv_sample_hash(const char* line, const char* line_end, unsigned int num_outputs) {
+    //Every field but the outputs is a pixel
+    size_t fields = 1;
+    for (const char* c = line; c < line_end; c++)
+        fields += *c == ',';
+    size_t count = fields > num_outputs ? fields - num_outputs : 0;
+    //A line without pixels hashes like an empty image
+    if (count == 0)
+        return sample_hash(NULL, 0);
+
+    uint8_t stack_pixels[4096];
+    uint8_t* pixels = count <= sizeof(stack_pixels) ? stack_pixels : (uint8_t*)malloc(count);
+    //0 is never a hash (see sample_hash())
+    if (pixels == NULL)
+        return 0;
+    const char* p = line;
+    for (size_t i = 0; i < count; i++) {
+        while (p < line_end && (is_blank(*p) || *p == ','))
+            p++;
+        double value = 0.0;
+        const char* next = parse_real(p, line_end, &value);
+        if (next != NULL)
+            p = next;
+        value = value < 0.0 ? 0.0 : (value > 1.0 ? 1.0 : value);
+        pixels[i] = (uint8_t)(value * 255.0 + 0.5);
+    }
+    uint64_t h = sample_hash(pixels, count);
+    if (pixels != stack_pixels)
+        free(pixels);
+    return h;
+}
+
+int
+init_sample_hashes(SampleHashSet* set, uint64_t expected) {
+    memset(set, 0, sizeof(SampleHashSet));
+    set->capacity = SAMPLE_HASHES_MIN_CAPACITY;
+    while (set->capacity < 2 * expected)
+        set->capacity *= 2;
+    set->slots = (uint64_t*)calloc(set->capacity, sizeof(uint64_t));
+    return set->slots != NULL;
+}
+
+//Slot of the hash, or of the empty slot where it would go
+static uint64_t find_hash_slot(const uint64_t* slots, uint64_t capacity, uint64_t hash) {
+    uint64_t slot = hash & (capacity - 1);
+    while (slots[slot] != 0 && slots[slot] != hash)
+        slot = (slot + 1) & (capacity - 1);
+    return slot;
+}
+
+int
+sample_hashes_insert(SampleHashSet* set, uint64_t hash) {
+    //0 marks the empty slots, it is what a failed hash returns
+    if (hash == 0)
+        return -1;
+    uint64_t slot = find_hash_slot(set->slots, set->capacity, hash);
+    if (set->slots[slot] == hash)
+        return 0;
+
+    if (2 * (set->count + 1) > set->capacity) {
+        //Keep the table at most half full so probes stay short
+        uint64_t* slots = (uint64_t*)calloc(2 * set->capacity, sizeof(uint64_t));
+        if (slots == NULL)
+            return -1;
+        for (uint64_t s = 0; s < set->capacity; s++) {
+            if (set->slots[s] != 0)
+                slots[find_hash_slot(slots, 2 * set->capacity, set->slots[s])] = set->slots[s];
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity *= 2;
+        slot = find_hash_slot(set->slots, set->capacity, hash);
+    }
+    set->slots[slot] = hash;
+    set->count++;
+    return 1;
+}
+
+int
+build_sample_hashes(const char* data, size_t size, unsigned int num_outputs, SampleHashSet* set) {
+    if (!init_sample_hashes(set, (uint64_t)csv_count_rows(data, size)))
+        return 0;
+    set->data_size = size;
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end) {
+        const char* line_end = (const char*)memchr(p, '\n', end - p);
+        if (line_end == NULL)
+            line_end = end;
+        //Empty lines are not samples, a sample that cannot be hashed fails the whole set
+        uint64_t hash = line_end > p ? csv_sample_hash(p, line_end, num_outputs) : 1;
+        if (hash == 0 || (line_end > p && sample_hashes_insert(set, hash) < 0)) {
+            free_sample_hashes(set);
+            return 0;
+        }
+        p = line_end + 1;
+    }
+    return 1;
+}
+
+//Path of the hashes of a data set file (to be freed)
+static char* sample_hashes_path(const char* file_path) {
+    char* path = (char*)malloc(strlen(file_path) + sizeof(SAMPLE_HASHES_SUFFIX));
+    if (path != NULL)
+        sprintf(path, "%s%s", file_path, SAMPLE_HASHES_SUFFIX);
+    return path;
+}
+
+static int sample_hashes_header_matches(const unsigned char* header, uint64_t data_size) {
+    uint64_t capacity = get_u64(header + 16);
+    return memcmp(header, SAMPLE_HASHES_MAGIC, 4) == 0 && get_u32(header + 4) == SAMPLE_HASHES_VERSION &&
+           get_u64(header + 8) == data_size && capacity >= SAMPLE_HASHES_MIN_CAPACITY &&
+           (capacity & (capacity - 1)) == 0 && 2 * get_u64(header + 24) <= capacity;
+}
+
+int
+save_sample_hashes(const char* file_path, const SampleHashSet* set) {
+    char* path = sample_hashes_path(file_path);
+    FILE* file = path != NULL ? fopen(path, "wb") : NULL;
+    if (file == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot write the hashes of %s", file_path);
+        free(path);
+        return 0;
+    }
+
+    unsigned char header[SAMPLE_HASHES_HEADER_SIZE];
+    memcpy(header, SAMPLE_HASHES_MAGIC, 4);
+    put_u32(header + 4, SAMPLE_HASHES_VERSION);
+    put_u64(header + 8, set->data_size);
+    put_u64(header + 16, set->capacity);
+    put_u64(header + 24, set->count);
+    int written = fwrite(header, 1, SAMPLE_HASHES_HEADER_SIZE, file) == SAMPLE_HASHES_HEADER_SIZE;
+    for (uint64_t s = 0; s < set->capacity && written; s++) {
+        unsigned char slot[8];
+        put_u64(slot, set->slots[s]);
+        written = fwrite(slot, 1, 8, file) == 8;
+    }
+
+    if (fclose(file) != 0 || !written) {
+        mlp_log(MLP_LOG_ERROR, "Cannot write the hashes of %s", file_path);
+        remove(path);
+        free(path);
+        return 0;
+    }
+    free(path);
+    return 1;
+}
+
+//Read the whole hash file of a data set of data_size bytes, returns 0 when it is missing or stale
+static int read_sample_hashes(const char* path, uint64_t data_size, SampleHashSet* set) {
+    memset(set, 0, sizeof(SampleHashSet));
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return 0;
+    unsigned char header[SAMPLE_HASHES_HEADER_SIZE];
+    unsigned char* slots = NULL;
+    int loaded = fread(header, 1, SAMPLE_HASHES_HEADER_SIZE, file) == SAMPLE_HASHES_HEADER_SIZE &&
+                 sample_hashes_header_matches(header, data_size);
+    if (loaded) {
+        set->data_size = data_size;
+        set->capacity = get_u64(header + 16);
+        set->count = get_u64(header + 24);
+        slots = (unsigned char*)malloc(set->capacity * 8);
+        set->slots = (uint64_t*)malloc(set->capacity * sizeof(uint64_t));
+        loaded = slots != NULL && set->slots != NULL && fread(slots, 8, set->capacity, file) == set->capacity;
+    }
+    fclose(file);
+    for (uint64_t s = 0; loaded && s < set->capacity; s++)
+        set->slots[s] = get_u64(slots + 8 * s);
+    free(slots);
+    if (!loaded)
+        free_sample_hashes(set);
+    return loaded;
+}
+
+//Probe the hash file in place: 1 when the hash was added, 0 when it is there already and -1 when
+//the table has to be rewritten (full or unreadable)
+static int add_hash_in_place(int fd, const unsigned char* header, uint64_t new_data_size, uint64_t hash) {
+    uint64_t capacity = get_u64(header + 16);
+    uint64_t count = get_u64(header + 24);
+    if (2 * (count + 1) > capacity)
+        return -1;
+
+    unsigned char bytes[8];
+    uint64_t slot = hash & (capacity - 1);
+    for (uint64_t probes = 0; probes < capacity; probes++) {
+        if (pread(fd, bytes, 8, SAMPLE_HASHES_HEADER_SIZE + 8 * slot) != 8)
+            return -1;
+        uint64_t value = get_u64(bytes);
+        if (value == hash)
+            return 0;
+        if (value == 0)
+            break;
+        slot = (slot + 1) & (capacity - 1);
+    }
+
+    //The slot goes first so an interrupted insert leaves a valid (stale) table
+    unsigned char updated[SAMPLE_HASHES_HEADER_SIZE];
+    memcpy(updated, header, SAMPLE_HASHES_HEADER_SIZE);
+    put_u64(bytes, hash);
+    put_u64(updated + 8, new_data_size);
+    put_u64(updated + 24, count + 1);
+    if (pwrite(fd, bytes, 8, SAMPLE_HASHES_HEADER_SIZE + 8 * slot) != 8 ||
+        pwrite(fd, updated, SAMPLE_HASHES_HEADER_SIZE, 0) != SAMPLE_HASHES_HEADER_SIZE)
+        return -1;
+    return 1;
+}
+
+int
+add_sample_hash(const char* file_path, uint64_t data_size, uint64_t new_data_size, uint64_t hash, unsigned int num_outputs) {
+    if (hash == 0)
+        return -1;
+    char* path = sample_hashes_path(file_path);
+    if (path == NULL)
+        return -1;
+
+    int fd = open(path, O_RDWR);
+    unsigned char header[SAMPLE_HASHES_HEADER_SIZE];
+    if (fd >= 0 && pread(fd, header, SAMPLE_HASHES_HEADER_SIZE, 0) == SAMPLE_HASHES_HEADER_SIZE &&
+        sample_hashes_header_matches(header, data_size)) {
+        int added = add_hash_in_place(fd, header, new_data_size, hash);
+        if (added >= 0) {
+            close(fd);
+            free(path);
+            return added;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    //Missing, stale or full: read (or rebuild) the whole table, add the hash and write it back
+    SampleHashSet set;
+    if (!read_sample_hashes(path, data_size, &set)) {
+        MappedFile file;
+        int built = 0;
+        if (data_size == 0) {
+            built = init_sample_hashes(&set, 0);
+        } else if (map_file(file_path, &file)) {
+            built = file.size == data_size && build_sample_hashes(file.data, file.size, num_outputs, &set);
+            unmap_file(&file);
+        }
+        if (!built) {
+            mlp_log(MLP_LOG_ERROR, "Cannot hash the samples of %s", file_path);
+            free(path);
+            return -1;
+        }
+    }
+    free(path);
+    int added = sample_hashes_insert(&set, hash);
+    if (added == 1)
+        set.data_size = new_data_size;
+    if (added >= 0 && !save_sample_hashes(file_path, &set))
+        added = -1;
+    free_sample_hashes(&set);
+    return added;
+}
+
+void
+free_sample_hashes(SampleHashSet* set) {
+    free(set->slots);
+    memset(set, 0, sizeof(SampleHashSet));
+}
+
+//== IDX files ==
+
+static uint32_t get_u32_be(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+//Check the IDX header of a mapped file (unsigned bytes, 'dimensions' sizes) and read its sizes.
+//Returns the offset of the data, 0 when the file is not such an IDX file
+static size_t read_idx_header(const MappedFile* file, const char* file_path, int dimensions, uint32_t* sizes) {
+    const unsigned char* data = (const unsigned char*)file->data;
+    size_t header_size = 4 + 4 * (size_t)dimensions;
+    if (file->size < header_size || data[0] != 0 || data[1] != 0 || data[2] != IDX_TYPE_UBYTE || data[3] != dimensions) {
+        mlp_log(MLP_LOG_ERROR, "%s is not an IDX file of %d dimensional unsigned bytes", file_path, dimensions);
+        return 0;
+    }
+    //The product of the sizes is checked against the file at every step, so it cannot overflow
+    uint64_t elements = 1, available = file->size - header_size;
+    int truncated = 0;
+    for (int d = 0; d < dimensions; d++) {
+        sizes[d] = get_u32_be(data + 4 + 4 * d);
+        if (sizes[d] != 0 && elements > available / sizes[d])
+            truncated = 1;
+        else
+            elements *= sizes[d];
+    }
+    if (truncated || elements > available) {
+        mlp_log(MLP_LOG_ERROR, "%s is truncated", file_path);
+        return 0;
+    }
+    return header_size;
+}
+
+int
+load_idx_dataset(const char* images_path, const char* labels_path, Dataset* dataset) {
+    memset(dataset, 0, sizeof(Dataset));
+    MappedFile labels_file;
+    if (!map_file(images_path, &dataset->mapping))
+        return 0;
+    if (!map_file(labels_path, &labels_file)) {
+        free_dataset(dataset);
+        return 0;
+    }
+
+    uint32_t image_sizes[3], label_sizes[1];
+    size_t pixels_offset = read_idx_header(&dataset->mapping, images_path, 3, image_sizes);
+    size_t labels_offset = read_idx_header(&labels_file, labels_path, 1, label_sizes);
+    int loaded = pixels_offset != 0 && labels_offset != 0;
+    if (loaded && image_sizes[0] != label_sizes[0]) {
+        mlp_log(MLP_LOG_ERROR, "%u images but %u labels", image_sizes[0], label_sizes[0]);
+        loaded = 0;
+    }
+    //Empty files have nothing to train or evaluate on
+    if (loaded && (image_sizes[0] == 0 || image_sizes[1] == 0 || image_sizes[2] == 0)) {
+        mlp_log(MLP_LOG_ERROR, "%s holds no images (%u of %u x %u)", images_path, image_sizes[0], image_sizes[1], image_sizes[2]);
+        loaded = 0;
+    }
+    uint64_t num_inputs = (uint64_t)image_sizes[1] * image_sizes[2];
+    if (loaded && num_inputs > UINT32_MAX) {
+        mlp_log(MLP_LOG_ERROR, "%s has images of %u x %u pixels, too many", images_path, image_sizes[1], image_sizes[2]);
+        loaded = 0;
+    }
+    if (loaded) {
+        dataset->num_samples = image_sizes[0];
+        dataset->height = image_sizes[1];
+        dataset->width = image_sizes[2];
+        dataset->num_inputs = (uint32_t)num_inputs;
+        dataset->pixels = (uint8_t*)(dataset->mapping.data + pixels_offset);
+        madvise((void*)dataset->mapping.data, dataset->mapping.size, MADV_RANDOM);
+
+        //Labels are widened to u16 (the only copy, 2 bytes a sample) and there is a class for
+        //every label up to the largest one, named after its index
+        dataset->labels = (uint16_t*)malloc(((size_t)dataset->num_samples + 1) * sizeof(uint16_t));
+        loaded = dataset->labels != NULL;
+        const unsigned char* labels = (const unsigned char*)labels_file.data + labels_offset;
+        for (unsigned int i = 0; loaded && i < dataset->num_samples; i++) {
+            dataset->labels[i] = labels[i];
+            if (labels[i] >= dataset->num_classes)
+                dataset->num_classes = labels[i] + 1u;
+        }
+    }
+    unmap_file(&labels_file);
+
+    if (loaded) {
+        //At most 256 names of up to 3 digits
+        dataset->names_block = (char*)malloc(4 * (size_t)dataset->num_classes + 1);
+        loaded = dataset->names_block != NULL;
+        size_t names_size = 0;
+        for (unsigned int c = 0; loaded && c < dataset->num_classes; c++)
+            names_size += sprintf(dataset->names_block + names_size, "%u", c) + 1;
+        loaded = loaded && split_class_names(dataset, names_size);
+    }
+    if (!loaded) {
+        mlp_log(MLP_LOG_ERROR, "Cannot load the IDX data set %s, %s", images_path, labels_path);
+        free_dataset(dataset);
+        return 0;
+    }
+    return 1;
+}
+
+//Is the buffer one of the data set allocations rather than part of its mapping
+static int owned_by_dataset(const Dataset* dataset, const void* buffer) {
+    const char* p = (const char*)buffer;
+    return dataset->mapping.data == NULL || p < dataset->mapping.data || p >= dataset->mapping.data + dataset->mapping.size;
+}
+
+void
+free_dataset(Dataset* dataset) {
+    free(dataset->class_names);
+    //Mapped data sets may still own some of their buffers (the widened labels of IDX files)
+    if (owned_by_dataset(dataset, dataset->names_block))
+        free(dataset->names_block);
+    if (owned_by_dataset(dataset, dataset->pixels))
+        free(dataset->pixels);
+    if (owned_by_dataset(dataset, dataset->labels))
+        free(dataset->labels);
+    unmap_file(&dataset->mapping);
+    memset(dataset, 0, sizeof(Dataset));
+}
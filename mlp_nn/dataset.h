@@ -0,0 +1,254 @@
+#ifndef DATASET_H_
+#define DATASET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "matrix.h"
+
+//Loading of the data sets the network is trained on. Files are memory-mapped (read only) and
+//parsed straight out of the mapping, without reading them into buffers or splitting lines.
+
+//A read-only mapping of a whole file
+typedef struct {
+    const char* data;
+    size_t size;
+} MappedFile;
+
+//Map the file, returns 0 (after printing why) on failure
+int map_file(const char* file_path, MappedFile* file);
+
+//Unmap the file and reset it
+void unmap_file(MappedFile* file);
+
+//Parse a decimal number starting at p (no further than end) into value. Returns the first
+//character after the number, or NULL when p does not start with one. When the digits form an
+//integer below 2^53 and the decimal exponent is within 22 (every value the data set writers
+//produce) the number is converted directly, the rest go through strtod(). Both are correctly
+//rounded
+const char* parse_real(const char* p, const char* end, double* value);
+
+//Number of rows (lines) in a CSV buffer. A final line without a newline counts, a trailing empty
+//line does not
+int csv_count_rows(const char* data, size_t size);
+
+//Parse CSV rows of num_inputs + num_outputs comma separated values into rows
+//[first_row, first_row + rows) of the initialized input and output matricies. Missing values are
+//left as they are, extra values are ignored. Returns 0 (after printing the offending text) when a
+//value is not a number
+int parse_csv_rows(const char* data, size_t size, int first_row, int rows, unsigned int num_inputs, unsigned int num_outputs,
+                   Matrix* input_nodes, Matrix* output_nodes);
+
+//The CSV loader cuts the file at newlines into about this many chunks per thread, each of at
+//least CSV_MIN_CHUNK_SIZE bytes
+#define CSV_CHUNKS_PER_THREAD 4
+#define CSV_MIN_CHUNK_SIZE (256 * 1024)
+
+//Initialize the input and output matricies for every row of the CSV buffer and parse it. Rows are
+//counted and parsed in chunks on the thread pool (see thread_pool.h), each chunk writes its own
+//rows of the matricies. Returns the number of rows, 0 on failure (the matricies are then freed)
+int load_csv_dataset(const char* data, size_t size, unsigned int num_inputs, unsigned int num_outputs,
+                     Matrix* input_nodes, Matrix* output_nodes);
+
+//== Binary data sets ==
+//Images stored as raw 8-bit pixels with a class index per sample, about 1 byte per pixel on disk
+//and in memory (a CSV row spends ~9 bytes of text per pixel and 8 bytes once parsed). All the
+//fields are little endian:
+//  offset  0  "MLPD"
+//          4  u32 version (DATASET_VERSION)
+//          8  u32 number of samples
+//         12  u32 pixels per sample (width * height)
+//         16  u32 width, 20 u32 height
+//         24  u32 number of classes
+//         28  u32 size of the class names block
+//         32  u64 offset of the pixels, 40 u64 offset of the labels
+//         48  class names, one NUL terminated string per class
+//  pixels (DATASET_ALIGNMENT aligned): samples * pixels per sample u8, row after row
+//  labels: samples u16 class indices
+#define DATASET_MAGIC "MLPD"
+#define DATASET_VERSION 1
+#define DATASET_HEADER_SIZE 48
+#define DATASET_ALIGNMENT 64
+
+typedef struct {
+    unsigned int num_samples;
+    //Pixels per sample and the image shape they come from
+    unsigned int num_inputs;
+    unsigned int width;
+    unsigned int height;
+    unsigned int num_classes;
+    //num_classes names (pointing into names_block)
+    char** class_names;
+    char* names_block;
+    //num_samples * num_inputs pixels and num_samples labels
+    uint8_t* pixels;
+    uint16_t* labels;
+    //File the names, pixels and labels point into when mapped (see map_binary_dataset()), no
+    //mapping when they were allocated
+    MappedFile mapping;
+} Dataset;
+
+//Does the file start with the binary data set magic
+int is_binary_dataset(const char* file_path);
+
+//Read a binary data set, returns 0 (after printing why) on failure
+int load_binary_dataset(const char* file_path, Dataset* dataset);
+
+//Map a binary data set read only, without reading it: the pixels and labels point straight into
+//the mapping and the page cache keeps whatever part is in use resident, so data sets larger than
+//the memory can be trained on. The kernel is told the access is random (training samples are
+//drawn at random, read-ahead would only evict useful pages). Only the labels are read, to check
+//them. Returns 0 (after printing why) on failure
+int map_binary_dataset(const char* file_path, Dataset* dataset);
+
+//Write the data set in the binary format, returns 0 on failure
+int save_binary_dataset(const char* file_path, const Dataset* dataset);
+
+//Pixels of a sample, a view into the data set storage
+static inline const uint8_t* dataset_pixels(const Dataset* dataset, int sample) {
+    return dataset->pixels + (size_t)sample * dataset->num_inputs;
+}
+
+//Fill a sample in: the pixels normalized to [0, 1] into inputs (num_inputs values) and the label
+//one-hot encoded into outputs (num_classes values)
+void dataset_fetch(const Dataset* dataset, int sample, mlp_real* inputs, mlp_real* outputs);
+
+//Build a data set from parsed CSV matricies: inputs in [0, 1] are quantized to 8 bits and the
+//label is the largest output. Class names are optional (NULL names them class0, class1...).
+//Returns 0 on failure
+int dataset_from_matricies(Dataset* dataset, Matrix* input_nodes, Matrix* output_nodes,
+                           unsigned int width, unsigned int height, const char* const* class_names);
+
+//== Row index of CSV data sets ==
+//A side file (the data set path + DATASET_INDEX_SUFFIX) with the byte range and class of every
+//row plus the number of rows of each class, so a row is appended in O(1) (one record and a header
+//update) and loaders can seek straight to a sample or to the samples of a class instead of
+//parsing the whole file. All the fields are little endian:
+//  offset  0  "MLPX"
+//          4  u32 version (DATASET_INDEX_VERSION)
+//          8  u32 number of classes
+//         12  u32 reserved (0)
+//         16  u64 size of the data set file the index describes (a stale index is rebuilt)
+//         24  u64 number of rows
+//         32  u64 rows per class, one per class
+//  then one record per row: u64 offset, u32 length (without the newline), u16 class, u16 reserved
+#define DATASET_INDEX_MAGIC "MLPX"
+#define DATASET_INDEX_VERSION 1
+#define DATASET_INDEX_SUFFIX ".index"
+#define DATASET_INDEX_HEADER_SIZE 32
+#define DATASET_INDEX_RECORD_SIZE 16
+//Class of a row without outputs (such as an empty line)
+#define DATASET_NO_LABEL 0xffff
+
+typedef struct {
+    uint64_t offset;
+    uint32_t length;
+    uint16_t label;
+} DatasetIndexRow;
+
+typedef struct {
+    uint64_t data_size;
+    unsigned int num_classes;
+    int num_rows;
+    DatasetIndexRow* rows;
+    //Rows of each class: class_counts[c] row numbers in class_rows[c] (pointing into class_block)
+    int* class_counts;
+    int** class_rows;
+    int* class_block;
+} DatasetIndex;
+
+//Index a CSV buffer (rows of values ending with num_classes outputs, the class is the largest
+//output) the way the CSV loader numbers its rows. Returns 0 on failure
+int build_dataset_index(const char* data, size_t size, unsigned int num_classes, DatasetIndex* index);
+
+//Read the index of the data set file, building and saving it when it is missing or does not
+//match the file (other size or number of classes). Returns 0 (after printing why) on failure
+int load_dataset_index(const char* file_path, unsigned int num_classes, DatasetIndex* index);
+
+//Write the index of the data set file, returns 0 on failure
+int save_dataset_index(const char* file_path, const DatasetIndex* index);
+
+//Record a row of 'length' bytes appended at 'offset' of the data set file that was previously
+//data_size bytes long (the row must already be written): one record is written and the header
+//updated in place, the data set is not read. An index that is missing or does not describe the
+//first data_size bytes is rebuilt from the whole data set instead. Returns 0 on failure
+int append_dataset_index(const char* file_path, uint64_t data_size, uint64_t offset, uint32_t length,
+                         unsigned int label, unsigned int num_classes);
+
+//Parse the listed rows of an indexed CSV buffer (such as the class_rows of a class) into rows 0,
+//1... of the initialized matricies, jumping to each through the index. Returns 0 on failure
+int parse_indexed_rows(const char* data, const DatasetIndex* index, const int* row_numbers, int rows,
+                       unsigned int num_inputs, unsigned int num_outputs, Matrix* input_nodes, Matrix* output_nodes);
+
+//Free the index
+void free_dataset_index(DatasetIndex* index);
+
+//== Sample hashes ==
+//64-bit content hashes of the 8-bit pixels of every sample of a data set, kept in a side file
+//(the data set path + SAMPLE_HASHES_SUFFIX) so the same image is not added twice. The file is an
+//open addressing hash table (linear probing, at most half full) read and written in place, so a
+//lookup or an insert touches a couple of slots whatever the size of the data set. All the
+//fields are little endian:
+//  offset  0  "MLPH"
+//          4  u32 version (SAMPLE_HASHES_VERSION)
+//          8  u64 size of the data set file the hashes describe (stale hashes are rebuilt)
+//         16  u64 number of slots (a power of two)
+//         24  u64 number of hashes
+//         32  u64 slots, 0 for an empty one
+#define SAMPLE_HASHES_MAGIC "MLPH"
+#define SAMPLE_HASHES_VERSION 1
+#define SAMPLE_HASHES_SUFFIX ".hashes"
+#define SAMPLE_HASHES_HEADER_SIZE 32
+#define SAMPLE_HASHES_MIN_CAPACITY 64
+
+//Hash of the pixels of a sample (never 0)
+uint64_t sample_hash(const uint8_t* pixels, size_t count);
+
+//Hash of a CSV sample: its inputs (values in [0, 1]) quantized back to the 8-bit pixels they were
+//written from, so it matches the sample_hash() of the image. Returns 0 on failure
+uint64_t csv_sample_hash(const char* line, const char* line_end, unsigned int num_outputs);
+
+typedef struct {
+    uint64_t data_size;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t* slots;
+} SampleHashSet;
+
+//Empty set sized for about 'expected' hashes, returns 0 on failure
+int init_sample_hashes(SampleHashSet* set, uint64_t expected);
+
+//Add the hash, growing the table as needed. Returns 1 when it was added, 0 when it was already
+//in the set and -1 on failure (a hash of 0 included)
+int sample_hashes_insert(SampleHashSet* set, uint64_t hash);
+
+//Hash every sample of a CSV buffer (rows ending with num_outputs outputs). Returns 0 on failure
+int build_sample_hashes(const char* data, size_t size, unsigned int num_outputs, SampleHashSet* set);
+
+//Write the hashes of the data set file, returns 0 on failure
+int save_sample_hashes(const char* file_path, const SampleHashSet* set);
+
+//Add the hash of a sample about to be appended to the data set file (data_size bytes long now,
+//new_data_size with the sample) in place in its hash file. Hashes that are missing or do not
+//describe the data set are rebuilt from it first. Returns 1 when the sample is new (it may be
+//appended), 0 when it is a duplicate (nothing changes) and -1 on failure (a hash of 0 included)
+int add_sample_hash(const char* file_path, uint64_t data_size, uint64_t new_data_size, uint64_t hash, unsigned int num_outputs);
+
+//Free the hashes
+void free_sample_hashes(SampleHashSet* set);
+
+//== IDX files ==
+//The format of the MNIST family of data sets: a big endian header (two zero bytes, the element
+//type, the number of dimensions and a u32 size per dimension) followed by the elements. Images
+//are an n x height x width file of unsigned bytes (IDX3), labels an n file of them (IDX1)
+#define IDX_TYPE_UBYTE 0x08
+
+//Load an IDX3 image file and its IDX1 label file as a data set. The images are mapped (see
+//map_binary_dataset()) and only the labels are read, so a 60k sample set is ready to train on
+//without a CSV round trip. The classes are named after their label. Returns 0 (after printing
+//why) on failure, files without any image included
+int load_idx_dataset(const char* images_path, const char* labels_path, Dataset* dataset);
+
+//Free (or unmap) the data set
+void free_dataset(Dataset* dataset);
+
+#endif
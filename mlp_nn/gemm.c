@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gemm.h"
+#include "log.h"
+#include "matrix.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+//Packing buffers, one set per thread. They grow to the largest block seen and are then reused
+static __thread mlp_real* packed_a = NULL;
+static __thread mlp_real* packed_b = NULL;
+static __thread size_t packed_a_size = 0;
+static __thread size_t packed_b_size = 0;
+
+//Make sure the packing buffer holds at least 'size' elements
+static mlp_real* reserve_pack_buffer(mlp_real** buffer, size_t* capacity, size_t size) {
+    if (size > *capacity) {
+        void* mem = NULL;
+        if (posix_memalign(&mem, MATRIX_ALIGNMENT, size * sizeof(mlp_real)) != 0) {
+            mlp_log(MLP_LOG_ERROR, "Cannot allocate GEMM packing buffer");
+            return NULL;
+        }
+        matrix_count_allocation();
+        free(*buffer);
+        *buffer = (mlp_real*)mem;
+        *capacity = size;
+    }
+    return *buffer;
+}
+
+//Address of element (row, col) of op(X)
+static inline const mlp_real* op_element(const mlp_real* x, int ld, int trans, int row, int col) {
+    return trans ? x + (size_t)col * ld + row : x + (size_t)row * ld + col;
+}
+
+void gemm_apply_epilogue(const GemmEpilogue* epilogue, int col, mlp_real* c, int ldc, int rows, int cols) {
+    if (epilogue == NULL)
+        return;
+
+    const SimdKernels* kernels = simd_kernels();
+    for (int i = 0; i < rows; i++) {
+        mlp_real* c_row = c + (size_t)i * ldc;
+        if (epilogue->bias != NULL)
+            kernels->axpy(cols, 1.0, epilogue->bias + col, c_row);
+        if (epilogue->activation != NULL)
+            epilogue->activation(cols, c_row);
+    }
+}
+
+//Textbook triple loop, walks B down its columns (accumulates in double precision)
+void gemm_reference(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+                    const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc) {
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            double sum = 0.0;
+            for (int p = 0; p < k; p++)
+                sum += *op_element(a, lda, trans_a, i, p) * *op_element(b, ldb, trans_b, p, j);
+            c[(size_t)i * ldc + j] += alpha * sum;
+        }
+    }
+}
+
+//For every row of A accumulate scaled rows of B into the row of C. Every access to B and C is unit
+//stride and four rows of B are folded in per pass so the row of C is loaded and stored 4x less
+//often. With B transposed its rows are the columns of op(B), so C is built from dot products
+void gemm_rowwise(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+                  const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc,
+                  const GemmEpilogue* epilogue) {
+    const SimdKernels* kernels = simd_kernels();
+    if (trans_b) {
+        if (trans_a) {
+            gemm_reference(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, c, ldc);
+            gemm_apply_epilogue(epilogue, 0, c, ldc, m, n);
+            return;
+        }
+        for (int i = 0; i < m; i++) {
+            for (int j = 0; j < n; j++)
+                c[(size_t)i * ldc + j] += alpha * kernels->dot(k, a + (size_t)i * lda, b + (size_t)j * ldb);
+            gemm_apply_epilogue(epilogue, 0, c + (size_t)i * ldc, ldc, 1, n);
+        }
+        return;
+    }
+
+    for (int i = 0; i < m; i++) {
+        mlp_real* c_row = c + (size_t)i * ldc;
+        int p = 0;
+        for (; p + 4 <= k; p += 4) {
+            mlp_real coeffs[4];
+            for (int q = 0; q < 4; q++)
+                coeffs[q] = alpha * *op_element(a, lda, trans_a, i, p + q);
+            const mlp_real* b0 = b + (size_t)p * ldb;
+            kernels->axpy4(n, coeffs, b0, b0 + ldb, b0 + 2 * (size_t)ldb, b0 + 3 * (size_t)ldb, c_row);
+        }
+        for (; p < k; p++)
+            kernels->axpy(n, alpha * *op_element(a, lda, trans_a, i, p), b + (size_t)p * ldb, c_row);
+        //The row is final and still in L1
+        gemm_apply_epilogue(epilogue, 0, c_row, ldc, 1, n);
+    }
+}
+
+//Pack an mc x kc block of op(A), scaled by alpha, into panels of mr rows. Inside a panel the mr
+//values of each column are contiguous, rows past the edge are zero filled
+static void pack_a(int mc, int kc, const mlp_real* a, int lda, int trans, mlp_real alpha, int mr, mlp_real* dst) {
+    for (int i = 0; i < mc; i += mr) {
+        int rows = mc - i < mr ? mc - i : mr;
+        for (int p = 0; p < kc; p++) {
+            for (int r = 0; r < rows; r++)
+                dst[r] = alpha * *op_element(a, lda, trans, i + r, p);
+            for (int r = rows; r < mr; r++)
+                dst[r] = 0.0;
+            dst += mr;
+        }
+    }
+}
+
+//Pack a kc x nc block of op(B) into panels of nr columns (one contiguous row of nr values for
+//each p), columns past the edge are zero filled
+static void pack_b(int kc, int nc, const mlp_real* b, int ldb, int trans, int nr, mlp_real* dst) {
+    for (int j = 0; j < nc; j += nr) {
+        int cols = nc - j < nr ? nc - j : nr;
+        for (int p = 0; p < kc; p++) {
+            if (trans) {
+                for (int r = 0; r < cols; r++)
+                    dst[r] = b[(size_t)(j + r) * ldb + p];
+            } else {
+                const mlp_real* b_row = b + (size_t)p * ldb + j;
+                for (int r = 0; r < cols; r++)
+                    dst[r] = b_row[r];
+            }
+            for (int r = cols; r < nr; r++)
+                dst[r] = 0.0;
+            dst += nr;
+        }
+    }
+}
+
+//Blocked GEMM in the usual five loop order: NC columns of B, KC deep slices, MC rows of A and
+//then the register tiles inside the packed blocks. An MC x NC block of C is final once the last KC
+//slice has gone through the micro-kernel, the epilogue is applied to it right then (still in L2)
+void gemm_blocked(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+                  const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc,
+                  const GemmEpilogue* epilogue) {
+    const SimdKernels* kernels = simd_kernels();
+    int mr = kernels->gemm_mr, nr = kernels->gemm_nr;
+    int nc_max = n < GEMM_NC ? n : GEMM_NC;
+    int kc_max = k < GEMM_KC ? k : GEMM_KC;
+    int mc_max = m < GEMM_MC ? m : GEMM_MC;
+    mlp_real* pa = reserve_pack_buffer(&packed_a, &packed_a_size,
+                                     (size_t)(mc_max + mr - 1) / mr * mr * kc_max);
+    mlp_real* pb = reserve_pack_buffer(&packed_b, &packed_b_size,
+                                     (size_t)(nc_max + nr - 1) / nr * nr * kc_max);
+    if (pa == NULL || pb == NULL) {
+        gemm_rowwise(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, c, ldc, epilogue);
+        return;
+    }
+
+    for (int jc = 0; jc < n; jc += GEMM_NC) {
+        int nc = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+        for (int pc = 0; pc < k; pc += GEMM_KC) {
+            int kc = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+            const GemmEpilogue* block_epilogue = pc + kc == k ? epilogue : NULL;
+            pack_b(kc, nc, op_element(b, ldb, trans_b, pc, jc), ldb, trans_b, nr, pb);
+
+            for (int ic = 0; ic < m; ic += GEMM_MC) {
+                int mc = m - ic < GEMM_MC ? m - ic : GEMM_MC;
+                pack_a(mc, kc, op_element(a, lda, trans_a, ic, pc), lda, trans_a, alpha, mr, pa);
+
+                for (int jr = 0; jr < nc; jr += nr) {
+                    int cols = nc - jr < nr ? nc - jr : nr;
+                    for (int ir = 0; ir < mc; ir += mr) {
+                        int rows = mc - ir < mr ? mc - ir : mr;
+                        kernels->gemm_micro_kernel(kc, pa + (size_t)ir * kc, pb + (size_t)jr * kc,
+                                                   c + (size_t)(ic + ir) * ldc + jc + jr, ldc, rows, cols);
+                    }
+                }
+                gemm_apply_epilogue(block_epilogue, jc, c + (size_t)ic * ldc + jc, ldc, mc, nc);
+            }
+        }
+    }
+}
+
+//Choose the kernel from the shape. Packing only pays off once every packed panel is reused,
+//which needs at least a full register tile of rows and columns and a reasonably deep k
+static void gemm_serial(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+                        const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc,
+                        const GemmEpilogue* epilogue) {
+    const SimdKernels* kernels = simd_kernels();
+    if (m < kernels->gemm_mr || n < kernels->gemm_nr || k < GEMM_MIN_BLOCKED_K)
+        gemm_rowwise(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, c, ldc, epilogue);
+    else
+        gemm_blocked(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, c, ldc, epilogue);
+}
+
+//A product split into a grid of row_tasks x col_tasks independent blocks of C
+typedef struct {
+    int trans_a, trans_b;
+    int m, n, k;
+    mlp_real alpha;
+    const mlp_real* a;
+    int lda;
+    const mlp_real* b;
+    int ldb;
+    mlp_real* c;
+    int ldc;
+    const GemmEpilogue* epilogue;
+    int row_chunk, col_chunk;
+    int col_tasks;
+} GemmJob;
+
+static void gemm_task(void* ctx, int task) {
+    GemmJob* job = (GemmJob*)ctx;
+    int i0 = task / job->col_tasks * job->row_chunk;
+    int j0 = task % job->col_tasks * job->col_chunk;
+    int rows = job->m - i0 < job->row_chunk ? job->m - i0 : job->row_chunk;
+    int cols = job->n - j0 < job->col_chunk ? job->n - j0 : job->col_chunk;
+    if (rows <= 0 || cols <= 0)
+        return;
+
+    //The bias of the block starts at its first column
+    GemmEpilogue block_epilogue;
+    const GemmEpilogue* epilogue = job->epilogue;
+    if (epilogue != NULL && epilogue->bias != NULL) {
+        block_epilogue = *epilogue;
+        block_epilogue.bias += j0;
+        epilogue = &block_epilogue;
+    }
+    gemm_serial(job->trans_a, job->trans_b, rows, cols, job->k, job->alpha,
+                op_element(job->a, job->lda, job->trans_a, i0, 0), job->lda,
+                op_element(job->b, job->ldb, job->trans_b, 0, j0), job->ldb,
+                job->c + (size_t)i0 * job->ldc + j0, job->ldc, epilogue);
+}
+
+//Round x up to a multiple of 'multiple'
+static int round_up(int x, int multiple) {
+    return (x + multiple - 1) / multiple * multiple;
+}
+
+void gemm(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+          const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc) {
+    gemm_fused(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, c, ldc, NULL);
+}
+
+void gemm_fused(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+                const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc,
+                const GemmEpilogue* epilogue) {
+    if (m <= 0 || n <= 0)
+        return;
+    if (k <= 0) {
+        //Nothing to accumulate, C is final as it is
+        gemm_apply_epilogue(epilogue, 0, c, ldc, m, n);
+        return;
+    }
+
+    int threads = thread_pool_num_threads();
+    if (threads <= 1 || (double)m * n * k < GEMM_PARALLEL_MIN_MACS) {
+        gemm_serial(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, c, ldc, epilogue);
+        return;
+    }
+
+    //Split the columns first (every thread reads its own part of B and shares A), then the rows
+    //when there are threads left over. Blocks are kept to whole register tiles
+    int col_tasks = (n + GEMM_PARALLEL_MIN_COLS - 1) / GEMM_PARALLEL_MIN_COLS;
+    if (col_tasks > threads)
+        col_tasks = threads;
+    int row_tasks = threads / col_tasks;
+    int max_row_tasks = (m + GEMM_PARALLEL_MIN_ROWS - 1) / GEMM_PARALLEL_MIN_ROWS;
+    if (row_tasks > max_row_tasks)
+        row_tasks = max_row_tasks;
+
+    GemmJob job = {trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, c, ldc, epilogue, 0, 0, 0};
+    job.col_chunk = round_up((n + col_tasks - 1) / col_tasks, SIMD_MAX_NR);
+    job.row_chunk = round_up((m + row_tasks - 1) / row_tasks, SIMD_MAX_MR);
+    job.col_tasks = (n + job.col_chunk - 1) / job.col_chunk;
+    row_tasks = (m + job.row_chunk - 1) / job.row_chunk;
+    thread_pool_run(row_tasks * job.col_tasks, gemm_task, &job);
+}
@@ -0,0 +1,68 @@
+#ifndef GEMM_H_
+#define GEMM_H_
+
+#include "real.h"
+#include "simd.h"
+
+//General matrix multiply kernels behind dot_product(). All matricies are row-major with a
+//leading dimension (the stride in elements between consecutive rows). An operand flagged with
+//GEMM_TRANS is read transposed in place: op(A) is m x k, so a transposed A is stored k x m.
+
+#define GEMM_NO_TRANS 0
+#define GEMM_TRANS 1
+
+//The register tile computed by the micro-kernel depends on the instruction set (see simd.h).
+//Cache blocks (multiples of every register tile): an MC x KC block of A is packed to stay in L2,
+//a KC x NC block of B in L3
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 1024
+
+//Below these sizes packing costs more than it saves and the row-wise kernel is used
+#define GEMM_MIN_BLOCKED_K 16
+
+//Products smaller than this (in multiply-adds) run serially, larger ones are split across the
+//thread pool (see thread_pool.h) in blocks of at least this many rows and columns of C
+#define GEMM_PARALLEL_MIN_MACS (128 * 1024)
+#define GEMM_PARALLEL_MIN_ROWS 8
+#define GEMM_PARALLEL_MIN_COLS 16
+
+//Work fused into a product once a block of C is final (while it is still in cache): a bias row is
+//added to every row of C and then the activation is applied. Either can be NULL
+typedef struct {
+    //n values, bias[j] is added to column j of C
+    const mlp_real* bias;
+    SigmoidKernel activation;
+} GemmEpilogue;
+
+//C (m x n) += alpha * op(A) (m x k) * op(B) (k x n). Picks a kernel from the shape of the product
+//and splits large products across threads
+void gemm(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+          const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc);
+
+//gemm() followed by the epilogue (NULL for none), which runs on every block of C as soon as the
+//kernel has finished it instead of in a separate pass over C
+void gemm_fused(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+                const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc,
+                const GemmEpilogue* epilogue);
+
+//Apply the epilogue to a rows x cols block of C that starts at column col
+void gemm_apply_epilogue(const GemmEpilogue* epilogue, int col, mlp_real* c, int ldc, int rows, int cols);
+
+//Textbook i-j-k triple loop (kept as a reference for testing and benchmarks)
+void gemm_reference(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+                    const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc);
+
+//Streams the rows of B for each row of A (i-k-j order), or takes dot products of rows when B is
+//transposed. Best for vector-matrix products
+void gemm_rowwise(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+                  const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc,
+                  const GemmEpilogue* epilogue);
+
+//Cache blocked GEMM with packed panels and a register tiled (vectorized) micro-kernel. The
+//transposes and alpha are absorbed by the packing
+void gemm_blocked(int trans_a, int trans_b, int m, int n, int k, mlp_real alpha,
+                  const mlp_real* a, int lda, const mlp_real* b, int ldb, mlp_real* c, int ldc,
+                  const GemmEpilogue* epilogue);
+
+#endif
@@ -0,0 +1,83 @@
+#include "mlp_nn.h"
+
+//Write a weights file out as a C++ header defining a FixedNetwork (see includes/fixed_network.hpp)
+//with the topology of the file and its weights as constants, for builds pinned to one model:
+//  ./gen_network <weights> <header> [variable name, default productionNetwork]
+//The header declares 'static const FixedNetwork<784, 200, 2> productionNetwork = {...}' for the
+//784-200-2 network. The weights are hexadecimal floating point literals, so they are exactly the
+//ones of the file
+
+static const char*
+sigmoid_mode_name(SigmoidMode mode) {
+    switch (mode) {
+        case SIGMOID_FAST:
+            return "SIGMOID_FAST";
+        case SIGMOID_EXACT:
+            return "SIGMOID_EXACT";
+        default:
+            return "SIGMOID_ACCURATE";
+    }
+}
+
+static int
+write_header(FILE* out, const MLP_NN* mlp, const MLP_WeightsInfo* info, const char* weights_path, const char* name) {
+    fprintf(out, "//Generated by mlp_nn/gen_network from %s, do not edit\n", weights_path);
+    fprintf(out, "#include \"../includes/fixed_network.hpp\"\n\n");
+    fprintf(out, "static const FixedNetwork<");
+    for (unsigned int l = 0; l < info->num_layers; l++)
+        fprintf(out, l == 0 ? "%u" : ", %u", info->layers[l]);
+    fprintf(out, "> %s = {\n", name);
+    fprintf(out, "    %s,\n    {\n", sigmoid_mode_name(info->sigmoid_mode));
+
+    //Every weight, row after row of every layer with the zeros padding the rows like the matrix
+    //storage does (see fixedStride()), brace elision puts them in place
+    for (unsigned int l = 0; l + 1 < info->num_layers; l++) {
+        const Matrix* weights = &mlp->weights[l];
+        fprintf(out, "        //Layer %u: %d x %d\n", l, weights->rows, weights->columns);
+        for (int i = 0; i < weights->rows; i++) {
+            const mlp_real* row = matrix_row(weights, i);
+            fprintf(out, "       ");
+            for (int j = 0; j < weights->columns; j++)
+                fprintf(out, " %a,", (double)row[j]);
+            for (int j = weights->columns; j < weights->stride; j++)
+                fprintf(out, " 0,");
+            fprintf(out, "\n");
+        }
+    }
+    fprintf(out, "    }\n};\n");
+    return !ferror(out);
+}
+
+int
+main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <weights> <header> [variable name]\n", argv[0]);
+        return 1;
+    }
+    const char* name = argc > 3 ? argv[3] : "productionNetwork";
+
+    MLP_NN mlp = {0};
+    MLP_WeightsInfo info;
+    size_t num_weight_layers = load_mlp_model(&mlp, argv[1], &info);
+    if (num_weight_layers == 0)
+        return 1;
+    //The header holds the weights at the precision of this build, more would be lost
+    if (info.element_size > sizeof(mlp_real))
+        mlp_log(MLP_LOG_WARN, "%s holds float64 weights, the header gets them as %s", argv[1], MLP_REAL_NAME);
+
+    FILE* out = fopen(argv[2], "w");
+    int written = 0;
+    if (out == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Could not create %s", argv[2]);
+    } else {
+        written = write_header(out, &mlp, &info, argv[1], name);
+        written = fclose(out) == 0 && written;
+        if (!written)
+            mlp_log(MLP_LOG_ERROR, "Could not write %s", argv[2]);
+    }
+    if (written)
+        printf("%s: FixedNetwork of %u layers as %s\n", argv[2], info.num_layers, MLP_REAL_NAME);
+
+    free_mat_array(&mlp.weights, num_weight_layers);
+    return written ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include "log.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+//Level set by the program and the MLP_LOG override (-1 until read from the environment, -2 when
+//unset)
+static int requested_level = MLP_LOG_ERROR;
+static int environment_level = -1;
+
+static long progress_every_steps = 0;
+static double progress_every_seconds = MLP_PROGRESS_SECONDS;
+
+static int
+parse_log_level(const char* name) {
+    static const char* const names[] = {"silent", "error", "warn", "info", "debug"};
+    for (int level = MLP_LOG_SILENT; level <= MLP_LOG_DEBUG; level++) {
+        if (strcasecmp(name, names[level]) == 0)
+            return level;
+    }
+    return -2;
+}
+
+void
+mlp_set_log_level(MLP_LogLevel level) {
+    __atomic_store_n(&requested_level, (int)level, __ATOMIC_RELAXED);
+}
+
+MLP_LogLevel
+mlp_log_level(void) {
+    int level = __atomic_load_n(&environment_level, __ATOMIC_RELAXED);
+    if (level == -1) {
+        const char* name = getenv("MLP_LOG");
+        level = name != NULL ? parse_log_level(name) : -2;
+        if (name != NULL && level == -2)
+            fprintf(stderr, "WARNING: Unknown MLP_LOG level %s (silent, error, warn, info or debug)\n", name);
+        __atomic_store_n(&environment_level, level, __ATOMIC_RELAXED);
+    }
+    return (MLP_LogLevel)(level >= 0 ? level : __atomic_load_n(&requested_level, __ATOMIC_RELAXED));
+}
+
+void
+mlp_log(MLP_LogLevel level, const char* format, ...) {
+    if (!mlp_log_enabled(level))
+        return;
+    FILE* stream = level <= MLP_LOG_WARN ? stderr : stdout;
+    if (level == MLP_LOG_ERROR)
+        fputs("ERROR: ", stream);
+    else if (level == MLP_LOG_WARN)
+        fputs("WARNING: ", stream);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stream, format, args);
+    va_end(args);
+    fputc('\n', stream);
+}
+
+void
+mlp_log_matrix(MLP_LogLevel level, const char* title, int index, Matrix* mat) {
+    if (!mlp_log_enabled(level))
+        return;
+    printf("%s %d\n", title, index);
+    print_matrix(mat);
+}
+
+static double
+now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void
+mlp_set_progress_interval(long steps, double seconds) {
+    progress_every_steps = steps > 0 ? steps : 0;
+    progress_every_seconds = seconds > 0.0 ? seconds : 0.0;
+}
+
+void
+init_mlp_progress(MLP_Progress* progress, const char* label, long total_steps, int samples_per_step) {
+    memset(progress, 0, sizeof(MLP_Progress));
+    progress->label = label;
+    progress->enabled = mlp_log_enabled(MLP_LOG_INFO);
+    progress->total_steps = total_steps;
+    progress->samples_per_step = samples_per_step;
+    if (progress->enabled)
+        progress->start = progress->last_time = now_seconds();
+}
+
+void
+mlp_progress_step(MLP_Progress* progress, long step, double loss) {
+    if (!progress->enabled)
+        return;
+    progress->loss_sum += loss;
+    progress->loss_steps++;
+
+    long steps = step + 1 - progress->last_step;
+    int due = progress_every_steps > 0 && steps >= progress_every_steps;
+    double now = 0.0;
+    if (!due && progress_every_seconds > 0.0) {
+        now = now_seconds();
+        due = now - progress->last_time >= progress_every_seconds;
+    }
+    if (!due)
+        return;
+    if (now == 0.0)
+        now = now_seconds();
+
+    double seconds = now - progress->last_time;
+    mlp_log(MLP_LOG_INFO, "%s: step %ld/%ld (%.0f%%), loss %.6f, %.0f samples/s", progress->label, step + 1,
+            progress->total_steps, 100.0 * (step + 1) / progress->total_steps, progress->loss_sum / progress->loss_steps,
+            seconds > 0.0 ? (double)steps * progress->samples_per_step / seconds : 0.0);
+    progress->last_time = now;
+    progress->last_step = step + 1;
+    progress->loss_sum = 0.0;
+    progress->loss_steps = 0;
+}
+
+void
+finish_mlp_progress(MLP_Progress* progress) {
+    if (!progress->enabled)
+        return;
+    double seconds = now_seconds() - progress->start;
+    mlp_log(MLP_LOG_INFO, "%s: %ld steps of %d samples in %.3f s (%.0f samples/s)", progress->label, progress->total_steps,
+            progress->samples_per_step, seconds, seconds > 0.0 ? (double)progress->total_steps * progress->samples_per_step / seconds : 0.0);
+}
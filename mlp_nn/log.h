@@ -0,0 +1,77 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include "matrix.h"
+
+//Leveled logging of the library. Only errors are reported by default: the library prints nothing
+//while it works unless the program (or the MLP_LOG environment variable) asks for more, so console
+//I/O never ends up in a hot path.
+
+typedef enum {
+    //Nothing at all, not even errors
+    MLP_LOG_SILENT = 0,
+    //Failures, on stderr with an "ERROR: " prefix (the default)
+    MLP_LOG_ERROR,
+    //Suspicious input that was worked around, on stderr with a "WARNING: " prefix
+    MLP_LOG_WARN,
+    //What is loaded and saved and the training progress, on stdout
+    MLP_LOG_INFO,
+    //Every matrix of the forward passes and the weights files, on stdout
+    MLP_LOG_DEBUG
+} MLP_LogLevel;
+
+//Set the level. MLP_LOG=silent, error, warn, info or debug in the environment overrides it
+void mlp_set_log_level(MLP_LogLevel level);
+
+//Level in effect
+MLP_LogLevel mlp_log_level(void);
+
+//Would a message of this level be printed (to skip the work of preparing one)
+static inline int mlp_log_enabled(MLP_LogLevel level) {
+    return level != MLP_LOG_SILENT && level <= mlp_log_level();
+}
+
+//Print a message (a line, the newline is added) of this level
+void mlp_log(MLP_LogLevel level, const char* format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+//Print a titled matrix when the level is enabled
+void mlp_log_matrix(MLP_LogLevel level, const char* title, int index, Matrix* mat);
+
+//== Progress ==
+//Reports a long running loop (such as the training steps) at MLP_LOG_INFO: one line with the step,
+//the mean loss and the samples per second since the previous report, no more often than every
+//MLP_PROGRESS_SECONDS seconds (or every 'steps' steps, see mlp_set_progress_interval()). A step
+//costs a clock read when enabled and nothing otherwise
+#define MLP_PROGRESS_SECONDS 1.0
+
+typedef struct {
+    const char* label;
+    int enabled;
+    long total_steps;
+    int samples_per_step;
+    double start;
+    //Time, step and loss sum at the last report
+    double last_time;
+    long last_step;
+    double loss_sum;
+    long loss_steps;
+} MLP_Progress;
+
+//Report every 'steps' steps (0 for no step interval) or every 'seconds' seconds (0 for no time
+//interval), whichever comes first. The default is every MLP_PROGRESS_SECONDS seconds
+void mlp_set_progress_interval(long steps, double seconds);
+
+//Start reporting a loop of total_steps steps of samples_per_step samples each
+void init_mlp_progress(MLP_Progress* progress, const char* label, long total_steps, int samples_per_step);
+
+//Step 'step' (counted from 0) is done with the given loss, reports when an interval has passed
+void mlp_progress_step(MLP_Progress* progress, long step, double loss);
+
+//Report the whole loop: its steps, time and throughput
+void finish_mlp_progress(MLP_Progress* progress);
+
+#endif
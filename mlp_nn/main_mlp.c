@@ -1,5 +1,70 @@
 #include "mlp_nn.h"
 
+//Do two files hold the same bytes
+static int
+same_files(const char* path_a, const char* path_b) {
+    FILE* a = fopen(path_a, "rb");
+    FILE* b = fopen(path_b, "rb");
+    int same = a != NULL && b != NULL;
+    while (same) {
+        char buffer_a[4096], buffer_b[4096];
+        size_t read_a = fread(buffer_a, 1, sizeof(buffer_a), a);
+        size_t read_b = fread(buffer_b, 1, sizeof(buffer_b), b);
+        same = read_a == read_b && memcmp(buffer_a, buffer_b, read_a) == 0;
+        if (read_a < sizeof(buffer_a))
+            break;
+    }
+    if (a != NULL)
+        fclose(a);
+    if (b != NULL)
+        fclose(b);
+    return same;
+}
+
+//Map a saved weights file and save it again: the mapping is read only, saving must not write to
+//it, and the copy must be the same file
+static int
+check_mapped_save(MLP_NN* nn, const char* file_path, size_t num_of_hidden_layers) {
+    const char* copy_path = "weights_mapped.data";
+    MLP_NN mapped = *nn;
+    mapped.neurons = NULL;
+    memset(&mapped.weights_file, 0, sizeof(mapped.weights_file));
+    size_t num_weight_layers = map_mlp_weights(&mapped, file_path, num_of_hidden_layers);
+    if (num_weight_layers == 0)
+        return 0;
+    save_mlp_weights(&mapped, copy_path, num_weight_layers);
+    free_mlp_weights(&mapped, num_weight_layers);
+    int same = same_files(file_path, copy_path);
+    remove(copy_path);
+    if (!same)
+        mlp_log(MLP_LOG_ERROR, "Saving the mapped weights of %s did not give the same file", file_path);
+    return same;
+}
+
+//Train a few epochs and then many more: a training run allocates its workspace, which must be all
+//it allocates whatever the number of epochs (the steady state loop does not touch the heap, see
+//matrix_allocation_count()). Both runs come after a first training, which sized the lazily grown
+//buffers
+static int
+check_training_allocations(MLP_NN* nn, Matrix* inputs, Matrix* outputs, size_t num_weight_layers) {
+    int epochs[2] = {2, 50};
+    size_t allocations[2];
+    int epoch = nn->epoch;
+    for (int run = 0; run < 2; run++) {
+        nn->epoch = epochs[run];
+        size_t before = matrix_allocation_count();
+        train_mlp_model(nn, inputs, outputs, num_weight_layers);
+        allocations[run] = matrix_allocation_count() - before;
+    }
+    nn->epoch = epoch;
+    if (allocations[1] != allocations[0]) {
+        mlp_log(MLP_LOG_ERROR, "Training allocated %zu times in %d epochs but %zu times in %d epochs",
+                allocations[0], epochs[0], allocations[1], epochs[1]);
+        return 0;
+    }
+    return 1;
+}
+
 int
 main(int argc, char* argv[]) {
     //Initialize NN
@@ -10,10 +75,20 @@ main(int argc, char* argv[]) {
         .num_hidden = hidden_layer_nodes,
         .learning_rate = 0.05,
         .epoch = 10000,
+        //Samples per training step (stacked into one matrix product)
+        .batch_size = 1,
+        //SIGMOID_FAST trades accuracy for speed, SIGMOID_EXACT goes through libm (see simd.h)
+        .sigmoid_mode = SIGMOID_ACCURATE,
         //Initialize neurons and weights to NULL
         .neurons = NULL, .weights = NULL
     };
 
+    //Show the training progress and the neurons of every forward pass below (see log.h)
+    mlp_set_log_level(MLP_LOG_DEBUG);
+
+    //Set when one of the checks below fails
+    int failed = 0;
+
     //Initialize the input and output nodes
     Matrix input_nodes;
     Matrix output_nodes;
@@ -63,6 +138,10 @@ main(int argc, char* argv[]) {
 
         //Save all the weights into a file to be able to reuse the trained weights
         save_mlp_weights(&nn, "weights.data", sz);
+        if (!check_mapped_save(&nn, "weights.data", num_of_hidden_layers))
+            failed = 1;
+        if (!check_training_allocations(&nn, &input_nodes, &output_nodes, sz))
+            failed = 1;
 
         //Free memory
         free_matrix(inputs);
@@ -76,5 +155,5 @@ main(int argc, char* argv[]) {
     free_matrix(&input_nodes);
     free_matrix(&output_nodes);
     
-    return 0;
+    return failed;
 }
\ No newline at end of file
@@ -1,20 +1,109 @@
 #include "matrix.h"
+#include "gemm.h"
+#include "log.h"
+#include "simd.h"
+
+//Allocations made through the matrix code (updated atomically, matricies are built on any thread)
+static size_t allocation_count = 0;
+
+size_t matrix_allocation_count(void) {
+    return __atomic_load_n(&allocation_count, __ATOMIC_RELAXED);
+}
+
+void matrix_count_allocation(void) {
+    __atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+}
+
+//Round the row length up so that every row starts on a MATRIX_ALIGNMENT boundary
+static int matrix_stride(int columns) {
+    int per_line = MATRIX_ALIGNMENT / sizeof(mlp_real);
+    return (columns + per_line - 1) / per_line * per_line;
+}
 
 //Responsible for inititalizing the matrix
 void init_matrix(Matrix* mat, int rows, int columns) {
     mat->rows = rows;
     mat->columns = columns;
-    mat->data = (double**)malloc(rows * sizeof(double*));
-    //Use calloc to initialize each values to 0
+    mat->stride = matrix_stride(columns);
+
+    //One aligned block for all the elements (zeroed, like calloc) and the row views into it
+    size_t size = (size_t)rows * mat->stride * sizeof(mlp_real);
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, MATRIX_ALIGNMENT, size > 0 ? size : MATRIX_ALIGNMENT) != 0)
+        buffer = NULL;
+    mlp_real** data = buffer != NULL ? (mlp_real**)malloc((rows > 0 ? rows : 1) * sizeof(mlp_real*)) : NULL;
+    if (data == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate matrix of %d x %d", rows, columns);
+        free(buffer);
+        mat->rows = mat->columns = mat->stride = 0;
+        mat->buffer = NULL;
+        mat->data = NULL;
+        mat->capacity = 0;
+        mat->row_capacity = 0;
+        mat->borrowed = 0;
+        return;
+    }
+    memset(buffer, 0, size);
+    mat->buffer = (mlp_real*)buffer;
+    mat->borrowed = 0;
+    matrix_count_allocation();
+    mat->capacity = (size_t)rows * mat->stride;
+
+    mat->data = data;
+    matrix_count_allocation();
+    mat->row_capacity = rows;
     for (int i = 0; i < rows; i++)
-        mat->data[i] = (double*)calloc(columns, sizeof(double));
+        mat->data[i] = matrix_row(mat, i);
+}
+
+int init_matrix_view(Matrix* mat, int rows, int columns, mlp_real* buffer) {
+    mat->rows = rows;
+    mat->columns = columns;
+    mat->stride = matrix_stride(columns);
+    mat->buffer = buffer;
+    mat->capacity = (size_t)rows * mat->stride;
+    mat->borrowed = 1;
+
+    //Only the row views are allocated
+    mat->data = (mlp_real**)malloc((rows > 0 ? rows : 1) * sizeof(mlp_real*));
+    if (mat->data == NULL) {
+        mat->buffer = NULL;
+        mat->capacity = 0;
+        mat->row_capacity = 0;
+        return 0;
+    }
+    matrix_count_allocation();
+    mat->row_capacity = rows;
+    for (int i = 0; i < rows; i++)
+        mat->data[i] = matrix_row(mat, i);
+    return 1;
+}
+
+//Reshape the matrix in place when the storage allows it, otherwise reallocate. Borrowed storage
+//may be read only, a resized matrix is about to be written so it always gets its own
+void resize_matrix(Matrix* mat, int rows, int columns) {
+    int stride = matrix_stride(columns);
+    if (mat->buffer == NULL || mat->borrowed || (size_t)rows * stride > mat->capacity || rows > mat->row_capacity) {
+        free_matrix(mat);
+        init_matrix(mat, rows, columns);
+        return;
+    }
+
+    mat->rows = rows;
+    mat->columns = columns;
+    if (stride != mat->stride) {
+        mat->stride = stride;
+        for (int i = 0; i < rows; i++)
+            mat->data[i] = matrix_row(mat, i);
+    }
 }
 
 //Pass in the matrix to set random weight values (ranging from 0 to 1)
 void set_rand_weights(Matrix* mat) {
     for (int i = 0; i < mat->rows; i++) {
+        mlp_real* row = matrix_row(mat, i);
         for (int j = 0; j < mat->columns; j++) {
-            mat->data[i][j] = ((double)rand() / (double)RAND_MAX) - 0.5;
+            row[j] = (mlp_real)(((double)rand() / (double)RAND_MAX) - 0.5);
         }
     }
 }
@@ -23,28 +112,90 @@ void set_rand_weights(Matrix* mat) {
 void dot_product(Matrix* mat1, Matrix* mat2, Matrix* result) {
     //# of cols of mat1 == # of rows of mat2
     if (mat1->columns != mat2->rows) {
-        printf("ERROR: Number of columns (mat1) is not the same as number of rows (mat2)\n");
+        mlp_log(MLP_LOG_ERROR, "Number of columns (mat1) is not the same as number of rows (mat2)");
         return;
     }
 
     //Dot product of matrix (m,n) and matrix (n,k) results in (m,k)
     init_matrix(result, mat1->rows, mat2->columns);
 
-    //Dot product calculation
-    for (int i = 0; i < mat1->rows; i++) {
-        for (int j = 0; j < mat2->columns; j++) {
-            for (int k = 0; k < mat1->columns; k++) {
-                result->data[i][j] += mat1->data[i][k] * mat2->data[k][j];
-            }
-        }
-   }
+    //Dot product calculation (the kernel is chosen from the shape, see gemm.h)
+    gemm(GEMM_NO_TRANS, GEMM_NO_TRANS, mat1->rows, mat2->columns, mat1->columns, 1.0,
+         mat1->buffer, mat1->stride, mat2->buffer, mat2->stride, result->buffer, result->stride);
+}
+
+//Same as dot_product() but reuses the storage of the result matrix
+void dot_product_into(Matrix* mat1, Matrix* mat2, Matrix* result) {
+    if (mat1->columns != mat2->rows) {
+        mlp_log(MLP_LOG_ERROR, "Number of columns (mat1) is not the same as number of rows (mat2)");
+        return;
+    }
+
+    resize_matrix(result, mat1->rows, mat2->columns);
+    memset(result->buffer, 0, (size_t)result->rows * result->stride * sizeof(mlp_real));
+    gemm(GEMM_NO_TRANS, GEMM_NO_TRANS, mat1->rows, mat2->columns, mat1->columns, 1.0,
+         mat1->buffer, mat1->stride, mat2->buffer, mat2->stride, result->buffer, result->stride);
+}
+
+//Dense layer in one pass: the bias and activation are applied to each block of the product as soon
+//as the GEMM has finished it
+void dense_layer_into(Matrix* inputs, Matrix* weights, const mlp_real* bias, SigmoidKernel activation, Matrix* result) {
+    if (inputs->columns != weights->rows) {
+        mlp_log(MLP_LOG_ERROR, "Number of columns (mat1) is not the same as number of rows (mat2)");
+        return;
+    }
+
+    GemmEpilogue epilogue = {bias, activation};
+    resize_matrix(result, inputs->rows, weights->columns);
+    memset(result->buffer, 0, (size_t)result->rows * result->stride * sizeof(mlp_real));
+    gemm_fused(GEMM_NO_TRANS, GEMM_NO_TRANS, inputs->rows, weights->columns, inputs->columns, 1.0,
+               inputs->buffer, inputs->stride, weights->buffer, weights->stride, result->buffer, result->stride,
+               &epilogue);
+}
+
+//Accumulate a product of (possibly transposed) operands into the result
+void multiply_add_matrix(Matrix* mat1, int transpose1, Matrix* mat2, int transpose2, mlp_real alpha, Matrix* result) {
+    int m = transpose1 ? mat1->columns : mat1->rows;
+    int k = transpose1 ? mat1->rows : mat1->columns;
+    int k2 = transpose2 ? mat2->columns : mat2->rows;
+    int n = transpose2 ? mat2->rows : mat2->columns;
+    if (k != k2) {
+        mlp_log(MLP_LOG_ERROR, "Inner dimensions of the product do not match (%d and %d)", k, k2);
+        return;
+    }
+    if (result->rows != m || result->columns != n) {
+        mlp_log(MLP_LOG_ERROR, "Result matrix is %d x %d but the product is %d x %d", result->rows, result->columns, m, n);
+        return;
+    }
+    //The result is updated in place, borrowed storage may be read only
+    if (result->borrowed) {
+        mlp_log(MLP_LOG_ERROR, "Cannot accumulate into a matrix over borrowed storage");
+        return;
+    }
+
+    gemm(transpose1 ? GEMM_TRANS : GEMM_NO_TRANS, transpose2 ? GEMM_TRANS : GEMM_NO_TRANS, m, n, k, alpha,
+         mat1->buffer, mat1->stride, mat2->buffer, mat2->stride, result->buffer, result->stride);
+}
+
+//mat1^T * mat2 without building the transpose
+void dot_product_tn(Matrix* mat1, Matrix* mat2, Matrix* result) {
+    resize_matrix(result, mat1->columns, mat2->columns);
+    memset(result->buffer, 0, (size_t)result->rows * result->stride * sizeof(mlp_real));
+    multiply_add_matrix(mat1, 1, mat2, 0, 1.0, result);
+}
+
+//mat1 * mat2^T without building the transpose
+void dot_product_nt(Matrix* mat1, Matrix* mat2, Matrix* result) {
+    resize_matrix(result, mat1->rows, mat2->rows);
+    memset(result->buffer, 0, (size_t)result->rows * result->stride * sizeof(mlp_real));
+    multiply_add_matrix(mat1, 0, mat2, 1, 1.0, result);
 }
 
 //Subtract the two matricies and obtain the result
 void subtract_matrix(Matrix* mat1, Matrix* mat2, Matrix* result) {
    //Check if the matrices have the same dimensions
    if (mat1->rows != mat2->rows || mat1->columns != mat2->columns) {
-       printf("ERROR: Matrices must have the same dimensions to be subtracted.\n");
+       mlp_log(MLP_LOG_ERROR, "Matrices must have the same dimensions to be subtracted.");
        return;
    }
 
@@ -52,11 +203,22 @@ void subtract_matrix(Matrix* mat1, Matrix* mat2, Matrix* result) {
    init_matrix(result, mat1->rows, mat1->columns);
 
    //Subtract the two matrices
-   for (int i = 0; i < mat1->rows; i++) {
-       for (int j = 0; j < mat1->columns; j++) {
-           result->data[i][j] = mat1->data[i][j] - mat2->data[i][j];
-       }
+   const SimdKernels* kernels = simd_kernels();
+   for (int i = 0; i < mat1->rows; i++)
+       kernels->subtract(mat1->columns, matrix_row(mat1, i), matrix_row(mat2, i), matrix_row(result, i));
+}
+
+//Subtract into the storage of the result matrix
+void subtract_matrix_into(Matrix* mat1, Matrix* mat2, Matrix* result) {
+   if (mat1->rows != mat2->rows || mat1->columns != mat2->columns) {
+       mlp_log(MLP_LOG_ERROR, "Matrices must have the same dimensions to be subtracted.");
+       return;
    }
+
+   resize_matrix(result, mat1->rows, mat1->columns);
+   const SimdKernels* kernels = simd_kernels();
+   for (int i = 0; i < mat1->rows; i++)
+       kernels->subtract(mat1->columns, matrix_row(mat1, i), matrix_row(mat2, i), matrix_row(result, i));
 }
 
 //This calculates the transpose matrix (interchange row and columns of matrix)
@@ -66,32 +228,37 @@ void transpose_matrix(Matrix* mat1, Matrix* result) {
 
     //Transpose mat1 matrix and store into result
     for (int i = 0; i < mat1->rows; i++) {
+        const mlp_real* a = matrix_row(mat1, i);
         for (int j = 0; j < mat1->columns; j++)
-            result->data[j][i] = mat1->data[i][j];
+            result->buffer[(size_t)j * result->stride + i] = a[j];
+    }
+}
+
+//Transpose into the storage of the result matrix
+void transpose_matrix_into(Matrix* mat1, Matrix* result) {
+    resize_matrix(result, mat1->columns, mat1->rows);
+    for (int i = 0; i < mat1->rows; i++) {
+        const mlp_real* a = matrix_row(mat1, i);
+        for (int j = 0; j < mat1->columns; j++)
+            result->buffer[(size_t)j * result->stride + i] = a[j];
     }
 }
 
 //Copy memory from one matrix to another
 void copy_matrix(Matrix* dest, Matrix* src) {
-   //Free any existing data in the destination matrix
-   free_matrix(dest);
-
-   //Initialize the destination matrix with the same dimensions as the source matrix
-   init_matrix(dest, src->rows, src->columns);
+   //Give the destination matrix the same dimensions as the source matrix (only allocates when
+   //the existing storage is too small)
+   resize_matrix(dest, src->rows, src->columns);
 
-   //Copy data from the source matrix to the destination matrix
-   for (int i = 0; i < src->rows; i++) {
-       for (int j = 0; j < src->columns; j++) {
-           dest->data[i][j] = src->data[i][j];
-       }
-   }
+   //Both matricies share the same stride so the whole buffer can be copied at once
+   memcpy(dest->buffer, src->buffer, (size_t)src->rows * src->stride * sizeof(mlp_real));
 }
 
 //Obtain a one-row matrix by obtaining from a specified row index
 Matrix* get_row_matrix(Matrix* mat, int row) {
     //Check if the row index is valid
     if (row < 0 || row >= mat->rows) {
-        printf("ERROR: Invalid row index.\n");
+        mlp_log(MLP_LOG_ERROR, "Invalid row index.");
         return NULL;
     }
 
@@ -100,13 +267,12 @@ Matrix* get_row_matrix(Matrix* mat, int row) {
     if (!result) {
         return NULL;
     }
+    matrix_count_allocation();
     //Create the result matrix with 1 row and the same number of columns as the original matrix
     init_matrix(result, 1, mat->columns);
 
     //Copy the selected row from the original matrix to the result matrix
-    for (int j = 0; j < mat->columns; j++) {
-        result->data[0][j] = mat->data[row][j];
-    }
+    memcpy(result->buffer, matrix_row(mat, row), mat->columns * sizeof(mlp_real));
 
    return result;
 }
@@ -127,7 +293,12 @@ void free_matrix(Matrix* mat) {
         return;
     }
 
-    for (int i = 0; i < mat->rows; i++)
-        free(mat->data[i]);
+    if (!mat->borrowed)
+        free(mat->buffer);
     free(mat->data);
+    mat->borrowed = 0;
+    mat->buffer = NULL;
+    mat->data = NULL;
+    mat->capacity = 0;
+    mat->row_capacity = 0;
 }
\ No newline at end of file
@@ -3,31 +3,83 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "real.h"
+#include "simd.h"
 
-//This is a redefinition of the Matrix struct for a better and nicer format
+//Alignment (in bytes) of the matrix storage and of the start of every row
+#define MATRIX_ALIGNMENT 64
 
+//This is a redefinition of the Matrix struct for a better and nicer format.
+//The elements live in one contiguous row-major buffer, where row i starts at buffer + i * stride.
+//The stride is padded so that every row is MATRIX_ALIGNMENT aligned. The data array keeps a
+//pointer to each row so existing mat->data[i][j] accesses still work.
 typedef struct {
     int rows;
     int columns;
-    double** data;
+    int stride;
+    mlp_real* buffer;
+    mlp_real** data;
+    //Allocated elements in buffer and row views in data, resize_matrix() reuses them
+    size_t capacity;
+    int row_capacity;
+    //The buffer belongs to someone else (such as a read only file mapping): free_matrix() leaves
+    //it alone, and resizing the matrix or copying into it (whatever the size) moves it to storage
+    //of its own first
+    int borrowed;
 } Matrix;
 
+//Row view into the contiguous matrix storage
+static inline mlp_real* matrix_row(const Matrix* mat, int row) {
+    return mat->buffer + (size_t)row * mat->stride;
+}
+
 //Initialize matrix with rows and columns
 void init_matrix(Matrix* mat, int rows, int columns);
 
+//Initialize a rows x columns matrix over existing storage of the padded stride (see above),
+//without copying it. The matrix is borrowed: the storage must outlive it. Returns 0 on failure
+int init_matrix_view(Matrix* mat, int rows, int columns, mlp_real* buffer);
+
+//Change the shape of an initialized matrix. The existing storage is reused (no allocation) when
+//it is large enough and not borrowed, the element values are unspecified afterwards
+void resize_matrix(Matrix* mat, int rows, int columns);
+
 //Neural network specific function: Set random weight values
 void set_rand_weights(Matrix* mat);
 
 //Matrix multiplication - dot product
 void dot_product(Matrix* mat1, Matrix* mat2, Matrix* result); 
 
+//Dot product into an initialized result matrix (resized, so no allocation when it is big enough)
+void dot_product_into(Matrix* mat1, Matrix* mat2, Matrix* result);
+
+//Dense layer into an initialized result matrix: activation(inputs * weights + bias). The bias (one
+//value per column of weights) and the activation are optional (NULL) and fused into the product
+void dense_layer_into(Matrix* inputs, Matrix* weights, const mlp_real* bias, SigmoidKernel activation, Matrix* result);
+
+//Transpose-free products into an initialized result matrix: mat1^T * mat2 and mat1 * mat2^T.
+//The transposed operand is read in place
+void dot_product_tn(Matrix* mat1, Matrix* mat2, Matrix* result);
+void dot_product_nt(Matrix* mat1, Matrix* mat2, Matrix* result);
+
+//result += alpha * op(mat1) * op(mat2), op() transposes the operand when its flag is set. The
+//result must already have the shape of the product and storage of its own (not borrowed)
+void multiply_add_matrix(Matrix* mat1, int transpose1, Matrix* mat2, int transpose2, mlp_real alpha, Matrix* result);
+
 //Subtract two matricies
 void subtract_matrix(Matrix* mat1, Matrix* mat2, Matrix* result);
 
+//Subtract into an initialized result matrix (resized, so no allocation when it is big enough)
+void subtract_matrix_into(Matrix* mat1, Matrix* mat2, Matrix* result);
+
 //Obtain matrix transpose
 void transpose_matrix(Matrix* mat1, Matrix* result);
 
-//Copy matrix from mat1 to mat2
+//Transpose into an initialized result matrix (resized, so no allocation when it is big enough)
+void transpose_matrix_into(Matrix* mat1, Matrix* result);
+
+//Copy matrix from mat1 to mat2 (dest must be initialized, its storage is reused when big enough)
 void copy_matrix(Matrix* dest, Matrix* src);
 
 //Obtain a row from the matrix
@@ -39,5 +91,12 @@ void print_matrix(Matrix* mat);
 //Free the matrix
 void free_matrix(Matrix* mat);
 
+//Number of heap allocations made by the matrix code so far (matricies, row copies and GEMM
+//packing buffers). Comparing two readings shows whether a piece of code allocates
+size_t matrix_allocation_count(void);
+
+//Record an allocation in the counter above
+void matrix_count_allocation(void);
+
 
 #endif
\ No newline at end of file
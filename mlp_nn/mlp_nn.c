@@ -1,121 +1,132 @@
 #include "mlp_nn.h"
 
-//Used to remove whitespace (newlines, spaces and tabs) for later use
-void
-remove_whitespace(char* str) {
-   int i = 0, j = 0;
-   while (str[i] != '\0') {
-        //Pad to the left with index j
-        if (str[i] != ' ' && str[i] != '\t' && str[i] != '\n') {
-            str[j] = str[i];
-            j++;
-        }
-        i++;
-   }
-   //Null-terminate the string
-   str[j] = '\0';
-}
-
-//Get line count of file
-int
-get_file_line_count(const char* file_path) {
-    int count = 1;
-    char ch;
-    FILE* file = fopen(file_path, "r");
-    if (file == NULL) {
-        printf("ERROR: Cannot read file %s\n", file_path);
+//Expand a binary data set into the input and output matricies
+static int
+read_binary_dataset(const char* file_path, unsigned int num_inputs, unsigned int num_outputs,
+                    Matrix* input_nodes, Matrix* output_nodes) {
+    Dataset dataset;
+    if (!load_binary_dataset(file_path, &dataset))
+        return 0;
+    if (dataset.num_inputs != num_inputs || dataset.num_classes != num_outputs) {
+        mlp_log(MLP_LOG_ERROR, "Data set %s has %u inputs and %u classes, expected %u and %u",
+                file_path, dataset.num_inputs, dataset.num_classes, num_inputs, num_outputs);
+        free_dataset(&dataset);
         return 0;
     }
 
-    while (!feof(file)) {
-        ch = fgetc(file);
-        if (ch == '\n')
-            count++;
-    }
-    fclose(file);
-    return count;
+    init_matrix(input_nodes, dataset.num_samples, num_inputs);
+    init_matrix(output_nodes, dataset.num_samples, num_outputs);
+    for (unsigned int i = 0; i < dataset.num_samples; i++)
+        dataset_fetch(&dataset, i, matrix_row(input_nodes, i), matrix_row(output_nodes, i));
+    mlp_log(MLP_LOG_INFO, "Loaded %u samples of %u x %u pixels from %s", dataset.num_samples, dataset.width, dataset.height, file_path);
+    free_dataset(&dataset);
+    return 1;
 }
 
-//Read the data set and obtain the corresponding matricies from it
+//Read the data set and obtain the corresponding matricies from it. A CSV file is mapped once and
+//parsed in place, split across the thread pool
 int
 read_dataset(const char* file_path, unsigned int num_inputs, unsigned int num_outputs,
             Matrix* input_nodes, Matrix* output_nodes) {
-    //Initialize file
-    FILE *file = fopen(file_path, "r");
-    if (file == NULL) {
-        fprintf(stderr, "ERROR: Cannot read file %s\n", file_path);
+    if (is_binary_dataset(file_path))
+        return read_binary_dataset(file_path, num_inputs, num_outputs, input_nodes, output_nodes);
+
+    MappedFile file;
+    if (!map_file(file_path, &file))
         return 0;
-    }
 
-    //Get the line count from the file
-    int line_count = get_file_line_count(file_path);
-
-    //Store the matricies
-    init_matrix(input_nodes, line_count, num_inputs);
-    init_matrix(output_nodes, line_count, num_outputs);
-
-    //Read each line
-    char* line = NULL;
-    size_t len = 0;
-    ssize_t read;
-    //Read and store character, j stores each line
-    unsigned int j = 0;
-    while ((read = getline(&line, &len, file)) != -1) {
-        char* l = line;
-        char *toks, *saveptr;
-        unsigned int i;
-        //Read each token by its respective delimiter
-        for (toks = strtok_r(l, ",", &saveptr), i = 0;
-                toks != NULL && i < num_inputs + num_outputs;
-                toks = strtok_r(NULL, ",", &saveptr), i++) {
-            //Remove all whitespace in token (strtod() should automatically remove it but I'm keeping this for later)
-            remove_whitespace(toks);
-            //Convert token to double
-            char* endptr;
-            double value = strtod(toks, &endptr);
-            if (endptr == toks) {
-                fprintf(stderr, "ERROR: No valid digits were found in %s\n", toks);
-                //Close file steam and free memory on error 
-                fclose(file);
-                if (line)
-                    free(line);
-                return 0;
-            }
-            //Store the respective values in the input and output matricies
-            if (i < num_inputs)
-                input_nodes->data[j][i] = value;
-            else if (i >= num_inputs && i < num_inputs + num_outputs) {
-                output_nodes->data[j][i - num_inputs] = value;
-            }
-        }
-        j++;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int rows = load_csv_dataset(file.data, file.size, num_inputs, num_outputs, input_nodes, output_nodes);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    size_t size = file.size;
+    unmap_file(&file);
+    if (rows == 0) {
+        mlp_log(MLP_LOG_ERROR, "Cannot load data set %s", file_path);
+        return 0;
     }
 
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    if (seconds > 0.0)
+        mlp_log(MLP_LOG_INFO, "Loaded %d rows (%.1f MB) from %s: %.0f rows/s, %.1f MB/s",
+               rows, size / 1e6, file_path, rows / seconds, size / 1e6 / seconds);
+
     //Print the matricies
     // printf("== INPUT MATRIX ==\n");
     // print_matrix(input_nodes);
     // printf("== OUTPUT MATRIX ==\n");
     // print_matrix(output_nodes);
 
-    //Close file buffer and free other memory
-    fclose(file);
-    if (line)
-        free(line);
-
     return 1;
 }
 
+//Parse the listed rows of the indexed data set file into new matricies
+static int
+read_listed_rows(const char* file_path, const DatasetIndex* index, const int* row_numbers, int rows,
+                 unsigned int num_inputs, unsigned int num_outputs, Matrix* input_nodes, Matrix* output_nodes) {
+    MappedFile file;
+    if (rows <= 0 || !map_file(file_path, &file))
+        return 0;
+    init_matrix(input_nodes, rows, num_inputs);
+    init_matrix(output_nodes, rows, num_outputs);
+    int parsed = parse_indexed_rows(file.data, index, row_numbers, rows, num_inputs, num_outputs, input_nodes, output_nodes);
+    unmap_file(&file);
+    if (!parsed) {
+        mlp_log(MLP_LOG_ERROR, "Cannot load data set %s", file_path);
+        free_matrix(input_nodes);
+        free_matrix(output_nodes);
+        return 0;
+    }
+    return rows;
+}
+
+int
+read_dataset_rows(const char* file_path, int first_row, int rows, unsigned int num_inputs, unsigned int num_outputs,
+                  Matrix* input_nodes, Matrix* output_nodes) {
+    DatasetIndex index;
+    if (first_row < 0 || !load_dataset_index(file_path, num_outputs, &index))
+        return 0;
+    if (rows > index.num_rows - first_row)
+        rows = index.num_rows - first_row;
+
+    int read = 0;
+    int* row_numbers = (int*)malloc((rows > 0 ? rows : 1) * sizeof(int));
+    if (row_numbers != NULL) {
+        for (int i = 0; i < rows; i++)
+            row_numbers[i] = first_row + i;
+        read = read_listed_rows(file_path, &index, row_numbers, rows, num_inputs, num_outputs, input_nodes, output_nodes);
+    }
+    free(row_numbers);
+    free_dataset_index(&index);
+    return read;
+}
+
+int
+read_dataset_class(const char* file_path, unsigned int label, unsigned int num_inputs, unsigned int num_outputs,
+                   Matrix* input_nodes, Matrix* output_nodes) {
+    DatasetIndex index;
+    if (label >= num_outputs || !load_dataset_index(file_path, num_outputs, &index))
+        return 0;
+    int read = read_listed_rows(file_path, &index, index.class_rows[label], index.class_counts[label],
+                                num_inputs, num_outputs, input_nodes, output_nodes);
+    free_dataset_index(&index);
+    return read;
+}
+
 //Sigmoid activation function (1 / (1+e^(-x)))
 void sigmoid(Matrix* mat) {
+    sigmoid_with_mode(mat, SIGMOID_ACCURATE);
+}
+
+void sigmoid_with_mode(Matrix* mat, SigmoidMode mode) {
     if (mat == NULL || mat->data == NULL) {
-        printf("Error: Matrix data is not initialized\n");
+        mlp_log(MLP_LOG_ERROR, "Matrix data is not initialized");
         return;
     }
     
-    for (int i = 0; i < mat->rows; i++) {
-        for (int j = 0; j < mat->columns; j++)
-            mat->data[i][j] = 1 / (1 + exp(-mat->data[i][j]));
-    }
+    SigmoidKernel kernel = simd_sigmoid_kernel(simd_kernels(), mode);
+    for (int i = 0; i < mat->rows; i++)
+        kernel(mat->columns, matrix_row(mat, i));
 }
 
 //Initialize the random weights for the parsed in model (will modify the weights attribute)
@@ -151,39 +162,68 @@ initialize_rand_weights(MLP_NN* mlp, size_t num_of_hidden_layers) {
     return num_weights;
 }
 
+//Pass the inputs through the layers, storing every layer's activations in neurons (an array of
+//num_of_hidden_layers + 1 initialized matricies). The matricies are only resized so nothing is
+//allocated once they have been sized for the input
+static void
+propagate_layers(MLP_NN* mlp, Matrix* neurons, Matrix* inputs_neurons, size_t num_of_hidden_layers) {
+    SigmoidKernel activation = simd_sigmoid_kernel(simd_kernels(), mlp->sigmoid_mode);
+    copy_matrix(&neurons[0], inputs_neurons);
+    for (size_t i = 0; i < num_of_hidden_layers; i++) {
+        //Solve for the dot product of the net input, iterate for each weights on each layer. The
+        //sigmoid activation is fused into the product
+        dense_layer_into(&neurons[i], &mlp->weights[i], NULL, activation, &neurons[i+1]);
+    }
+}
+
 //Forward propagate the MLP neural network
 void
 init_mlp_model(MLP_NN* mlp, Matrix* inputs_neurons, size_t num_of_hidden_layers) {
-    //Copy inputs
-    Matrix input;
-    init_matrix(&input, inputs_neurons->rows, inputs_neurons->columns);
-    copy_matrix(&input, inputs_neurons);
-
+    //Size the neurons of every layer for the inputs
     mlp->neurons = (Matrix*)malloc((num_of_hidden_layers + 1) * sizeof(Matrix));
-    init_matrix(&mlp->neurons[0], input.rows, input.columns);
-    copy_matrix(&mlp->neurons[0], &input);
+    init_matrix(&mlp->neurons[0], inputs_neurons->rows, inputs_neurons->columns);
+    for (int i = 0; i < num_of_hidden_layers; i++)
+        init_matrix(&mlp->neurons[i+1], inputs_neurons->rows, mlp->weights[i].columns);
 
     //Loop calculate nodes for forward propagation
     // printf("===== INITIALIZE NEURONS (FORWARD PROPAGATION) =====\n");
-    // print_matrix(&mlp->neurons[0]);
-    for (int i = 0; i < num_of_hidden_layers; i++) {
-        Matrix res;
-        //Solve for the dot product of the net input, iterate for each weights on each layer
-        dot_product(&input, &mlp->weights[i], &res);
-        //Copy the result to the inputs
-        copy_matrix(&input, &res);
-        //Pass the activation function, sigmoid
-        sigmoid(&input);
-        //Print the matrix
-        //print_matrix(&input);
-        //Store the result into nodes matrix array
-        init_matrix(&mlp->neurons[i+1], input.rows, input.columns);
-        copy_matrix(&mlp->neurons[i+1], &input);
-        //Free unnecessary memory
-        free_matrix(&res);
+    propagate_layers(mlp, mlp->neurons, inputs_neurons, num_of_hidden_layers);
+}
+
+//Size the activations of every layer for up to max_rows input rows
+int
+init_mlp_plan(MLP_Plan* plan, MLP_NN* mlp, size_t num_of_hidden_layers, int max_rows) {
+    plan->num_of_hidden_layers = num_of_hidden_layers;
+    plan->max_rows = max_rows;
+    plan->activations = (Matrix*)malloc((num_of_hidden_layers + 1) * sizeof(Matrix));
+    if (plan->activations == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate the forward pass plan");
+        return 0;
+    }
+
+    init_matrix(&plan->activations[0], max_rows, mlp->num_inputs);
+    for (size_t i = 0; i < num_of_hidden_layers; i++)
+        init_matrix(&plan->activations[i+1], max_rows, mlp->weights[i].columns);
+    return 1;
+}
+
+//Forward pass through the preplanned activations, returns the output layer
+Matrix*
+mlp_plan_forward(MLP_Plan* plan, MLP_NN* mlp, Matrix* inputs_neurons) {
+    if (inputs_neurons->rows > plan->max_rows || inputs_neurons->columns != (int)mlp->num_inputs) {
+        mlp_log(MLP_LOG_ERROR, "Input of %d x %d does not fit the plan (%d x %u)",
+                inputs_neurons->rows, inputs_neurons->columns, plan->max_rows, mlp->num_inputs);
+        return NULL;
     }
 
-    free_matrix(&input);
+    propagate_layers(mlp, plan->activations, inputs_neurons, plan->num_of_hidden_layers);
+    return &plan->activations[plan->num_of_hidden_layers];
+}
+
+void
+free_mlp_plan(MLP_Plan* plan) {
+    if (plan->activations != NULL)
+        free_mat_array(&plan->activations, plan->num_of_hidden_layers + 1);
 }
 
 //Print MLP model (its neurons with weights)
@@ -205,179 +245,450 @@ print_mlp_nn(MLP_NN* mlp, size_t num_of_hidden_layers) {
 
 void
 forward_propagate(MLP_NN* mlp, Matrix* inputs_neurons, size_t num_of_hidden_layers) {
-    //== PASS IN FORWARD PROPAGATION (Might make this a separate function) ==
-    //Obtain the input again then forward pass
-    printf("=== FORWARD PROPAGATION ===\n");
-    Matrix input;
-    init_matrix(&input, inputs_neurons->rows, inputs_neurons->columns);
-    copy_matrix(&input, inputs_neurons);
-    printf("Neurons 0\n");
-    print_matrix(&input);
+    //== PASS IN FORWARD PROPAGATION ==
+    //The neurons from init_mlp_model() are reused so a pass does not allocate
+    propagate_layers(mlp, mlp->neurons, inputs_neurons, num_of_hidden_layers);
+    //Print the output of the activation matricies
+    mlp_log(MLP_LOG_DEBUG, "=== FORWARD PROPAGATION ===");
+    for (int i = 0; i < num_of_hidden_layers + 1; i++)
+        mlp_log_matrix(MLP_LOG_DEBUG, "Neurons", i, &mlp->neurons[i]);
+}
+
+//Size every training buffer for the largest shape it takes across the layers
+int
+init_mlp_train_workspace(MLP_TrainWorkspace* ws, MLP_NN* mlp, size_t num_of_hidden_layers) {
+    int batch_size = mlp->batch_size > 0 ? mlp->batch_size : 1;
+    int max_rows = 0, max_columns = 0;
     for (int i = 0; i < num_of_hidden_layers; i++) {
-        Matrix res;
-        //Solve for the dot product of the net input, iterate for each weights on each layer
-        dot_product(&input, &mlp->weights[i], &res);
-        //Copy the result to the inputs
-        copy_matrix(&input, &res);
-        //Pass the activation function, sigmoid
-        sigmoid(&input);
-        //Print the output of the activation matrix
-        printf("\nNeurons %i\n", i + 1);
-        print_matrix(&input);
-        //Store the result into nodes matrix array
-        free_matrix(&mlp->neurons[i+1]);
-        init_matrix(&mlp->neurons[i+1], input.rows, input.columns);
-        copy_matrix(&mlp->neurons[i+1], &input);
-        //Free unnecessary memory
-        free_matrix(&res);
-    }
-
-    free_matrix(&input);
+        if (mlp->weights[i].rows > max_rows)
+            max_rows = mlp->weights[i].rows;
+        if (mlp->weights[i].columns > max_columns)
+            max_columns = mlp->weights[i].columns;
+    }
+    int max_width = max_rows > max_columns ? max_rows : max_columns;
+
+    ws->num_of_hidden_layers = num_of_hidden_layers;
+    ws->batch_size = batch_size;
+    init_matrix(&ws->inputs, batch_size, mlp->num_inputs);
+    init_matrix(&ws->outputs, batch_size, mlp->num_outputs);
+    init_matrix(&ws->error, batch_size, max_width);
+    init_matrix(&ws->error_hidden, batch_size, max_width);
+    init_matrix(&ws->sig_derivative, batch_size, max_width);
+    if (ws->error.buffer == NULL || ws->error_hidden.buffer == NULL || ws->sig_derivative.buffer == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate the training workspace");
+        free_mlp_train_workspace(ws);
+        return 0;
+    }
+    return 1;
+}
+
+void
+free_mlp_train_workspace(MLP_TrainWorkspace* ws) {
+    free_matrix(&ws->inputs);
+    free_matrix(&ws->outputs);
+    free_matrix(&ws->error);
+    free_matrix(&ws->error_hidden);
+    free_matrix(&ws->sig_derivative);
 }
 
 //Train the model. This will do a backpropagation and forward propagation pass modifying the weights
-//of the passed in MLP.
+//of the passed in MLP. Each epoch stacks batch_size random samples into one matrix so both passes
+//are matrix-matrix products, and the weight gradients are averaged over the batch. Every buffer
+//comes from the training workspace so the epoch loop does not allocate (the allocation count is
+//reported at the end to check it). The progress (with the mean squared error of the batches) is
+//reported at MLP_LOG_INFO, see log.h
 void
-train_mlp_model(MLP_NN* mlp, Matrix* inputs_neurons_dataset, Matrix* outputs_neurons_dataset, size_t num_of_hidden_layers) {
-    printf("\n");
+train_mlp_model_from_source(MLP_NN* mlp, const MLP_SampleSource* source, size_t num_of_hidden_layers) {
+    const SimdKernels* kernels = simd_kernels();
+    if (mlp->weights_file.data != NULL) {
+        mlp_log(MLP_LOG_ERROR, "Mapped weights are read only, load them with load_mlp_weights() to train");
+        return;
+    }
+    if (source->num_samples <= 0) {
+        mlp_log(MLP_LOG_ERROR, "No samples to train on");
+        return;
+    }
+    MLP_TrainWorkspace ws;
+    if (!init_mlp_train_workspace(&ws, mlp, num_of_hidden_layers))
+        return;
+    //The summed gradients of the batch are scaled down to their mean
+    double step = -mlp->learning_rate / ws.batch_size;
+
+    //Allocations after the first epoch (which may still size lazily grown buffers such as the
+    //GEMM packing buffers) would mean the steady state loop touches the heap
+    size_t steady_allocations = 0;
+    MLP_Progress progress;
+    init_mlp_progress(&progress, "Training", mlp->epoch, ws.batch_size);
     for (int e = 0; e < mlp->epoch; e++) {
-        printf("\033[A\33[2KT\rEpoch %i\n", e);
-        Matrix error;
-        Matrix old_weights;
-        init_matrix(&old_weights, mlp->weights[num_of_hidden_layers - 1].rows, mlp->weights[num_of_hidden_layers - 1].columns);
-
-        //Obtain inputs and outputs from random indexes
-        unsigned int rand_index = rand() % (inputs_neurons_dataset->rows);
-        Matrix* inputs = get_row_matrix(inputs_neurons_dataset, rand_index);
-        Matrix* outputs = get_row_matrix(outputs_neurons_dataset, rand_index);
-
-        //== PASS IN FORWARD PROPAGATION (Might make this a separate function) ==
-        //Obtain the input again then forward pass
-        Matrix input_neurons;
-        init_matrix(&input_neurons, inputs->rows, inputs->columns);
-        copy_matrix(&input_neurons, inputs);
-        copy_matrix(&mlp->neurons[0], inputs);
-        for (int i = 0; i < num_of_hidden_layers; i++) {
-            Matrix res;
-            //Solve for the dot product of the net input, iterate for each weights on each layer
-            dot_product(&input_neurons, &mlp->weights[i], &res);
-            //Copy the result to the inputs
-            copy_matrix(&input_neurons, &res);
-            //Pass the activation function, sigmoid
-            sigmoid(&input_neurons);
-            //Store the result into nodes matrix array
-            free_matrix(&mlp->neurons[i+1]);
-            init_matrix(&mlp->neurons[i+1], input_neurons.rows, input_neurons.columns);
-            copy_matrix(&mlp->neurons[i+1], &input_neurons);
-            //Free unnecessary memory
-            free_matrix(&res);
+        if (e == 1)
+            steady_allocations = matrix_allocation_count();
+        double loss = 0.0;
+
+        //Obtain inputs and outputs from random indexes (a row of the batch each)
+        for (int b = 0; b < ws.batch_size; b++) {
+            unsigned int rand_index = rand() % (source->num_samples);
+            source->fetch(source->ctx, rand_index, matrix_row(&ws.inputs, b), matrix_row(&ws.outputs, b));
         }
 
+        //== PASS IN FORWARD PROPAGATION ==
+        propagate_layers(mlp, mlp->neurons, &ws.inputs, num_of_hidden_layers);
+
         //== PASS IN BACKWARD PROPAGATION (Might make this a separate function) ==
         for (int i = num_of_hidden_layers; i > 0; i--) {
             //Calculate error from the predicted output
             if (i == num_of_hidden_layers) {
-                subtract_matrix(&mlp->neurons[i], outputs, &error);
+                subtract_matrix_into(&mlp->neurons[i], &ws.outputs, &ws.error);
                 //printf("== Error ==\n");
-                //print_matrix(&error);
+                //print_matrix(&ws.error);
+                if (progress.enabled) {
+                    for (int j = 0; j < ws.error.rows; j++)
+                        loss += kernels->dot(ws.error.columns, matrix_row(&ws.error, j), matrix_row(&ws.error, j));
+                    loss /= (double)ws.error.rows * ws.error.columns;
+                }
             }
             //Calculate error for the hidden layers
             else {
-                //printf("\n= Hidden Layer Error =\n");
-                Matrix error_h;
-                Matrix transpose_weights;
-                transpose_matrix(&old_weights, &transpose_weights);
-
-                //Multiply and print resulting errors
-                dot_product(&error, &transpose_weights, &error_h);
-                //print_matrix(&error_h);
-
-                //Copy error_h to error for later use in backward pass
-                copy_matrix(&error, &error_h);
-
-                //Free unused matricies
-                free_matrix(&error_h);
-                free_matrix(&transpose_weights);
+                //The hidden layer error was propagated before the weights above were updated,
+                //swap it in as the error of this layer
+                Matrix swap = ws.error;
+                ws.error = ws.error_hidden;
+                ws.error_hidden = swap;
             }
 
             //In the backward pass we calculate the derivative of the cost function in respect to
             //the weights.
             //Derivative sigmoid (error * sigmoid(x) * (1 - sigmoid(x)) * output_prev_layer)
             //printf("== Sigmoid Derivative ==\n");
-            Matrix sig_derivative;
-            init_matrix(&sig_derivative, mlp->neurons[i].rows, mlp->neurons[i].columns);
-            for (int j = 0; j < mlp->neurons[i].rows; j++) {
-                for (int k = 0; k < mlp->neurons[i].columns; k++) {
-                    double x = mlp->neurons[i].data[j][k];
-                    sig_derivative.data[j][k] = error.data[j][k] * x * (1 - x);
-                }
-            }
-            //print_matrix(&sig_derivative);
-
-            //Multiply the previous layer nodes with the sigmoid derivative matrix
-            //printf("== Delta Weights ==\n");
-            Matrix delta_weights;
-            Matrix transpose_nodes;
-            transpose_matrix(&mlp->neurons[i-1], &transpose_nodes);
-            //NOTE: Transpose the nodes here and multiply them other way around
-            dot_product(&transpose_nodes, &sig_derivative, &delta_weights);
-
-            //Scalar multiply the learning rate with the resulting matrix
-            for (int j = 0; j < delta_weights.rows; j++) {
-                for (int k = 0; k < delta_weights.columns; k++)
-                    delta_weights.data[j][k] *= mlp->learning_rate;
-            }
-            //print_matrix(&delta_weights);
-
-            //Store old weights before updating
-            copy_matrix(&old_weights, &mlp->weights[i-1]);
-
-            //Print the new weights
+            resize_matrix(&ws.sig_derivative, mlp->neurons[i].rows, mlp->neurons[i].columns);
+            for (int j = 0; j < mlp->neurons[i].rows; j++)
+                kernels->sigmoid_grad(mlp->neurons[i].columns, matrix_row(&mlp->neurons[i], j),
+                                      matrix_row(&ws.error, j), matrix_row(&ws.sig_derivative, j));
+            //print_matrix(&ws.sig_derivative);
+
+            //Propagate the error to the previous layer through the weights before they are updated
+            //(error * weights^T, the weights are read transposed in place)
+            if (i > 1)
+                dot_product_nt(&ws.error, &mlp->weights[i-1], &ws.error_hidden);
+
+            //Apply the delta weights (previous layer nodes^T * sigmoid derivative, summed over the
+            //batch) scaled by the learning rate to the model weights by negating it. The GEMM reads
+            //the nodes transposed and accumulates straight into the weights
             //printf("= Resulting Weights =\n");
-            //Apply the delta weights to the model weights by negating it
-            for (int j = 0; j < mlp->weights[i-1].rows; j++) {
-                for (int k = 0; k < mlp->weights[i-1].columns; k++)
-                    mlp->weights[i-1].data[j][k] -= delta_weights.data[j][k];
-            }
+            multiply_add_matrix(&mlp->neurons[i-1], 1, &ws.sig_derivative, 0, step, &mlp->weights[i-1]);
             //print_matrix(&mlp->weights[i-1]);
-
-            //Free local scope memory
-            free_matrix(&transpose_nodes);
-            free_matrix(&delta_weights);
-            free_matrix(&sig_derivative);
         }
-        
+
         //print_mlp_nn(mlp, num_of_hidden_layers);
+        mlp_progress_step(&progress, e, loss);
+    }
+    finish_mlp_progress(&progress);
+
+    if (mlp->epoch > 1)
+        mlp_log(MLP_LOG_DEBUG, "Heap allocations in the training loop after the first epoch: %zu",
+                matrix_allocation_count() - steady_allocations);
+    free_mlp_train_workspace(&ws);
+}
+
+//The data set matricies as a sample source
+typedef struct {
+    Matrix* inputs;
+    Matrix* outputs;
+} MatrixSamples;
+
+static void
+fetch_matrix_sample(const void* ctx, int sample, mlp_real* inputs, mlp_real* outputs) {
+    const MatrixSamples* samples = (const MatrixSamples*)ctx;
+    memcpy(inputs, matrix_row(samples->inputs, sample), samples->inputs->columns * sizeof(mlp_real));
+    memcpy(outputs, matrix_row(samples->outputs, sample), samples->outputs->columns * sizeof(mlp_real));
+}
+
+void
+train_mlp_model(MLP_NN* mlp, Matrix* inputs_neurons_dataset, Matrix* outputs_neurons_dataset, size_t num_of_hidden_layers) {
+    MatrixSamples samples = {inputs_neurons_dataset, outputs_neurons_dataset};
+    MLP_SampleSource source = {inputs_neurons_dataset->rows, fetch_matrix_sample, &samples};
+    train_mlp_model_from_source(mlp, &source, num_of_hidden_layers);
+}
+
+static void
+fetch_dataset_sample(const void* ctx, int sample, mlp_real* inputs, mlp_real* outputs) {
+    dataset_fetch((const Dataset*)ctx, sample, inputs, outputs);
+}
+
+MLP_SampleSource
+dataset_sample_source(const Dataset* dataset) {
+    MLP_SampleSource source = {(int)dataset->num_samples, fetch_dataset_sample, dataset};
+    return source;
+}
 
-        //Free other unnecessary memory
-        free_matrix(&error);
-        free_matrix(&old_weights);
-        free_matrix(&input_neurons);
-        free_matrix(inputs);
-        free_matrix(outputs);
-        free(inputs);
-        free(outputs);
+//Legacy (headerless) weights files store doubles whatever the precision of the network. Single
+//precision rows are converted through a small buffer
+#define WEIGHT_CONVERT_CHUNK 256
+
+//Read a row of 'columns' elements of 'element_size' bytes (4 or 8) into the network precision
+static size_t
+read_weight_row(mlp_real* row, int columns, size_t element_size, FILE* file) {
+    if (element_size == sizeof(mlp_real))
+        return fread(row, sizeof(mlp_real), columns, file);
+
+    unsigned char chunk[WEIGHT_CONVERT_CHUNK * sizeof(double)];
+    size_t read = 0;
+    for (int j = 0; j < columns; j += WEIGHT_CONVERT_CHUNK) {
+        int n = columns - j < WEIGHT_CONVERT_CHUNK ? columns - j : WEIGHT_CONVERT_CHUNK;
+        size_t got = fread(chunk, element_size, n, file);
+        for (size_t c = 0; c < got; c++) {
+            if (element_size == sizeof(double)) {
+                double value;
+                memcpy(&value, chunk + c * sizeof(double), sizeof(double));
+                row[j + c] = (mlp_real)value;
+            } else {
+                float value;
+                memcpy(&value, chunk + c * sizeof(float), sizeof(float));
+                row[j + c] = (mlp_real)value;
+            }
+        }
+        read += got;
     }
+    return read;
 }
 
-//Save the weights into a file
+uint64_t
+weights_checksum(uint64_t h, const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*)data;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        h = (h ^ word) * 0x100000001b3ull;
+    }
+    if (i < size) {
+        uint64_t word = 0;
+        memcpy(&word, p + i, size - i);
+        h = (h ^ word) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+//Elements per stored row: the matrix stride of the element type
+static size_t
+weights_stride(unsigned int columns, size_t element_size) {
+    size_t per_line = MLP_WEIGHTS_ALIGNMENT / element_size;
+    return (columns + per_line - 1) / per_line * per_line;
+}
+
+//Where the payload of a weights file with num_layers layers starts: after the header and the layer
+//sizes, aligned
+static uint64_t
+weights_payload_offset(unsigned int num_layers) {
+    return (MLP_WEIGHTS_HEADER_SIZE + (uint64_t)num_layers * sizeof(uint32_t) + MLP_WEIGHTS_ALIGNMENT - 1) /
+           MLP_WEIGHTS_ALIGNMENT * MLP_WEIGHTS_ALIGNMENT;
+}
+
+//Header checksum: the fixed fields (without the checksum itself) and the layer sizes
+static uint64_t
+weights_header_checksum(const MLP_WeightsHeader* header, const uint32_t* layers) {
+    uint64_t h = weights_checksum(WEIGHTS_CHECKSUM_SEED, header, offsetof(MLP_WeightsHeader, header_checksum));
+    return weights_checksum(h, layers, header->num_layers * sizeof(uint32_t));
+}
+
+//Save the weights into a file (MLP_WEIGHTS_VERSION format, see mlp_nn.h)
 void
 save_mlp_weights(MLP_NN* mlp, const char* file_path, size_t num_of_hidden_layers) {
-    FILE* file = fopen(file_path, "w");
+    FILE* file = fopen(file_path, "wb");
     if (file == NULL) {
-        fprintf(stderr, "ERROR: Cannot write to file %s\n", file_path);
+        mlp_log(MLP_LOG_ERROR, "Cannot write to file %s", file_path);
+        return;
+    }
+
+    //Layer sizes: the rows of every weight matrix and the columns of the last one
+    if (num_of_hidden_layers < 1 || num_of_hidden_layers >= MLP_MAX_LAYERS) {
+        mlp_log(MLP_LOG_ERROR, "Cannot save %zu weight layers", num_of_hidden_layers);
+        fclose(file);
+        return;
     }
+    MLP_WeightsHeader header;
+    uint32_t layers[MLP_MAX_LAYERS];
+    memset(&header, 0, sizeof(header));
+    memset(layers, 0, sizeof(layers));
+    memcpy(header.magic, MLP_WEIGHTS_MAGIC, 4);
+    header.version = MLP_WEIGHTS_VERSION;
+    header.element_type = sizeof(mlp_real) == sizeof(float) ? MLP_WEIGHTS_FLOAT32 : MLP_WEIGHTS_FLOAT64;
+    header.activation = MLP_ACTIVATION_SIGMOID;
+    header.sigmoid_mode = mlp->sigmoid_mode;
+    header.num_layers = (uint32_t)num_of_hidden_layers + 1;
+    for (size_t layer = 0; layer < num_of_hidden_layers; layer++)
+        layers[layer] = mlp->weights[layer].rows;
+    layers[num_of_hidden_layers] = mlp->weights[num_of_hidden_layers - 1].columns;
+
+    //The rows are stored with the matrix stride (zero padded), so the payload has the layout of
+    //the matrix storage. The padding is written from zeros rather than from the rows: the weights
+    //may be mapped read only (see map_mlp_weights())
+    static const unsigned char padding[MLP_WEIGHTS_ALIGNMENT] = {0};
+    header.payload_offset = weights_payload_offset(header.num_layers);
+    uint64_t checksum = WEIGHTS_CHECKSUM_SEED;
+    for (size_t layer = 0; layer < num_of_hidden_layers; layer++) {
+        Matrix* weights = &mlp->weights[layer];
+        size_t stride = weights_stride(weights->columns, sizeof(mlp_real));
+        size_t row_size = weights->columns * sizeof(mlp_real);
+        //A trailing partial word of the row is checksummed zero padded, which the padding is
+        size_t padding_size = stride * sizeof(mlp_real) - (row_size + 7) / 8 * 8;
+        header.payload_size += (uint64_t)weights->rows * stride * sizeof(mlp_real);
+        for (int i = 0; i < weights->rows; i++) {
+            checksum = weights_checksum(checksum, matrix_row(weights, i), row_size);
+            checksum = weights_checksum(checksum, padding, padding_size);
+        }
+    }
+    header.payload_checksum = checksum;
+    header.header_checksum = weights_header_checksum(&header, layers);
+
+    size_t table_size = header.num_layers * sizeof(uint32_t);
+    int written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(layers, 1, table_size, file) == table_size &&
+                  fwrite(padding, 1, header.payload_offset - MLP_WEIGHTS_HEADER_SIZE - table_size, file) ==
+                      header.payload_offset - MLP_WEIGHTS_HEADER_SIZE - table_size;
+
+    for (size_t layer = 0; layer < num_of_hidden_layers && written; layer++) {
+        Matrix* weights = &mlp->weights[layer];
+        size_t stride = weights_stride(weights->columns, sizeof(mlp_real));
+        size_t padding_size = (stride - weights->columns) * sizeof(mlp_real);
+        for (int i = 0; i < weights->rows && written; i++) {
+            written = fwrite(matrix_row(weights, i), sizeof(mlp_real), weights->columns, file) == (size_t)weights->columns &&
+                      fwrite(padding, 1, padding_size, file) == padding_size;
+        }
+        mlp_log_matrix(MLP_LOG_DEBUG, "Weights", layer, weights);
+    }
+
+    if (fclose(file) != 0 || !written)
+        mlp_log(MLP_LOG_ERROR, "Cannot write the weights to %s", file_path);
+    else
+        mlp_log(MLP_LOG_INFO, "Saved %d weight layers to %s", (int)num_of_hidden_layers, file_path);
+}
 
-    printf("\nSAVING WEIGHTS\n");
-    for (int layer = 0; layer < num_of_hidden_layers; layer++) {
-        for (int i = 0; i < mlp->weights[layer].rows; i++)
-            fwrite(mlp->weights[layer].data[i], sizeof(double), mlp->weights[layer].columns, file);
+//Check the fields of a weights header, the layer sizes must be there once num_layers is in range
+static int
+valid_weights_header(const MLP_WeightsHeader* header, const uint32_t* layers) {
+    return header->version == MLP_WEIGHTS_VERSION && header->num_layers >= 2 && header->num_layers <= MLP_MAX_LAYERS &&
+           (layers == NULL || (header->header_checksum == weights_header_checksum(header, layers) &&
+                               (header->element_type == MLP_WEIGHTS_FLOAT32 || header->element_type == MLP_WEIGHTS_FLOAT64) &&
+                               header->activation == MLP_ACTIVATION_SIGMOID));
+}
+
+//Do the layer sizes of a weights file match the network (with the given number of hidden layers)
+static int
+weights_shape_matches(MLP_NN* mlp, size_t num_of_hidden_layers, const uint32_t* layers, uint32_t num_layers, const char* file_path) {
+    int matches = num_layers == num_of_hidden_layers + 2 && layers[0] == mlp->num_inputs && layers[num_layers - 1] == mlp->num_outputs;
+    for (size_t i = 0; matches && i < num_of_hidden_layers; i++)
+        matches = layers[i + 1] == mlp->num_hidden[i];
+    if (!matches)
+        mlp_log(MLP_LOG_ERROR, "%s holds a network of another shape", file_path);
+    return matches;
+}
 
-        printf("Weights %i\n", layer);
-        print_matrix(&mlp->weights[layer]);
+//Read and check the header of a weights file, leaving the file at the payload. Returns 1 for a
+//valid header, 0 (after printing why) for a damaged one and -1 when the file has no header
+static int
+read_weights_header(FILE* file, const char* file_path, MLP_WeightsHeader* header, uint32_t* layers) {
+    if (fread(header, sizeof(MLP_WeightsHeader), 1, file) != 1 || memcmp(header->magic, MLP_WEIGHTS_MAGIC, 4) != 0) {
+        fseek(file, 0, SEEK_SET);
+        return -1;
     }
+    if (!valid_weights_header(header, NULL) || fread(layers, sizeof(uint32_t), header->num_layers, file) != header->num_layers ||
+        !valid_weights_header(header, layers)) {
+        mlp_log(MLP_LOG_ERROR, "%s is not a valid version %d weights file", file_path, MLP_WEIGHTS_VERSION);
+        return 0;
+    }
+    if (fseek(file, (long)header->payload_offset, SEEK_SET) != 0) {
+        mlp_log(MLP_LOG_ERROR, "%s is truncated", file_path);
+        return 0;
+    }
+    return 1;
+}
 
+int
+read_mlp_weights_info(const char* file_path, MLP_WeightsInfo* info) {
+    memset(info, 0, sizeof(MLP_WeightsInfo));
+    FILE* file = fopen(file_path, "rb");
+    if (file == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot read from file %s", file_path);
+        return 0;
+    }
+    MLP_WeightsHeader header;
+    uint32_t layers[MLP_MAX_LAYERS];
+    int valid = read_weights_header(file, file_path, &header, layers);
     fclose(file);
+    if (valid != 1)
+        return 0;
+
+    info->num_layers = header.num_layers;
+    for (unsigned int i = 0; i < header.num_layers; i++)
+        info->layers[i] = layers[i];
+    info->element_size = header.element_type == MLP_WEIGHTS_FLOAT32 ? sizeof(float) : sizeof(double);
+    info->sigmoid_mode = (SigmoidMode)header.sigmoid_mode;
+    return 1;
+}
+
+//Read the weight matricies of the given layer sizes from the payload, checking its checksum when
+//the file has one
+static int
+read_weight_layers(MLP_NN* mlp, FILE* file, const int* layers, int num_weights, size_t element_size,
+                   int padded, const MLP_WeightsHeader* header) {
+    uint64_t checksum = WEIGHTS_CHECKSUM_SEED;
+    uint64_t payload_size = 0;
+    int converted = 0;
+    unsigned char padding[MLP_WEIGHTS_ALIGNMENT];
+    for (int layer = 0; layer < num_weights; layer++) {
+        Matrix* weights = &mlp->weights[layer];
+        init_matrix(weights, layers[layer], layers[layer+1]);
+        size_t stride = padded ? weights_stride(weights->columns, element_size) : (size_t)weights->columns;
+        size_t pad = (stride - weights->columns) * element_size;
+        payload_size += (uint64_t)weights->rows * stride * element_size;
+
+        if (padded && element_size == sizeof(mlp_real) && stride == (size_t)weights->stride) {
+            //Same layout as the matrix storage, the whole layer is read at once
+            size_t elements = (size_t)weights->rows * stride;
+            if (fread(weights->buffer, sizeof(mlp_real), elements, file) != elements)
+                return 0;
+            checksum = weights_checksum(checksum, weights->buffer, elements * sizeof(mlp_real));
+            continue;
+        }
+        for (int i = 0; i < weights->rows; i++) {
+            if (read_weight_row(matrix_row(weights, i), weights->columns, element_size, file) != (size_t)weights->columns ||
+                (pad > 0 && fread(padding, 1, pad, file) != pad))
+                return 0;
+        }
+        //Converted payloads are checked against the bytes of the file
+        converted = 1;
+    }
+
+    if (header != NULL) {
+        if (payload_size != header->payload_size) {
+            mlp_log(MLP_LOG_ERROR, "Weights payload of %llu bytes, the header says %llu",
+                    (unsigned long long)payload_size, (unsigned long long)header->payload_size);
+            return 0;
+        }
+        if (converted) {
+            //Converted on the way in, hash the stored bytes again
+            if (fseek(file, (long)header->payload_offset, SEEK_SET) != 0)
+                return 0;
+            unsigned char chunk[4096];
+            uint64_t left = header->payload_size;
+            checksum = WEIGHTS_CHECKSUM_SEED;
+            while (left > 0) {
+                size_t n = left < sizeof(chunk) ? (size_t)left : sizeof(chunk);
+                if (fread(chunk, 1, n, file) != n)
+                    return 0;
+                checksum = weights_checksum(checksum, chunk, n);
+                left -= n;
+            }
+        }
+        if (checksum != header->payload_checksum) {
+            mlp_log(MLP_LOG_ERROR, "Weights checksum mismatch, the file is damaged");
+            return 0;
+        }
+    } else if (fgetc(file) != EOF) {
+        mlp_log(MLP_LOG_ERROR, "Weights file is larger than the network");
+        return 0;
+    }
+    return 1;
 }
 
 //Load the weights froma file
@@ -394,32 +705,130 @@ load_mlp_weights(MLP_NN* mlp, const char* file_path, size_t num_of_hidden_layers
     layers[size_of_mlp_model - 1] = mlp->num_outputs;
 
     int num_weights = size_of_mlp_model - 1;
-    mlp->weights = (Matrix*)malloc(num_weights * sizeof(Matrix));
+    mlp->weights = NULL;
 
     //READ FROM FILE
     FILE* file = fopen(file_path, "rb");
     if (file == NULL) {
-        fprintf(stderr, "ERROR: Cannot read from file %s\n", file_path);
+        mlp_log(MLP_LOG_ERROR, "Cannot read from file %s", file_path);
+        free(layers);
+        return 0;
     }
 
-    printf("\nLOADING WEIGHTS\n");
-
-    for (int layer = 0; layer < num_weights; layer++) {
-        init_matrix(&mlp->weights[layer], layers[layer], layers[layer+1]);
-
-        for (int i = 0; i < mlp->weights[layer].rows; i++)
-            fread(mlp->weights[layer].data[i], sizeof(double), mlp->weights[layer].columns, file);
-        
-        printf("Weights %i\n", layer);
-        print_matrix(&mlp->weights[layer]);
+    //Files with a header must describe this network, legacy ones are raw doubles
+    MLP_WeightsHeader header;
+    uint32_t file_layers[MLP_MAX_LAYERS];
+    int has_header = read_weights_header(file, file_path, &header, file_layers);
+    int valid = has_header != 0;
+    if (has_header == 1)
+        valid = weights_shape_matches(mlp, num_of_hidden_layers, file_layers, header.num_layers, file_path);
+
+    if (valid) {
+        mlp->weights = (Matrix*)calloc(num_weights, sizeof(Matrix));
+        size_t element_size = has_header == 1 && header.element_type == MLP_WEIGHTS_FLOAT32 ? sizeof(float) : sizeof(double);
+        valid = mlp->weights != NULL &&
+                read_weight_layers(mlp, file, layers, num_weights, element_size, has_header == 1, has_header == 1 ? &header : NULL);
+        if (!valid) {
+            mlp_log(MLP_LOG_ERROR, "Cannot load the weights from %s", file_path);
+            if (mlp->weights != NULL)
+                free_mat_array(&mlp->weights, num_weights);
+        }
+    }
+    if (valid) {
+        if (has_header == 1)
+            mlp->sigmoid_mode = (SigmoidMode)header.sigmoid_mode;
+        mlp_log(MLP_LOG_INFO, "Loaded %d weight layers from %s", num_weights, file_path);
+        for (int layer = 0; layer < num_weights; layer++)
+            mlp_log_matrix(MLP_LOG_DEBUG, "Weights", layer, &mlp->weights[layer]);
     }
 
     free(layers);
     fclose(file);
 
+    return valid ? num_weights : 0;
+}
+
+size_t
+map_mlp_weights(MLP_NN* mlp, const char* file_path, size_t num_of_hidden_layers) {
+    mlp->weights = NULL;
+    MappedFile file;
+    if (!map_file(file_path, &file))
+        return 0;
+
+    //The header sits at the start of the (page aligned) mapping and the layer sizes right after it
+    const MLP_WeightsHeader* header = (const MLP_WeightsHeader*)file.data;
+    const uint32_t* layers = (const uint32_t*)(file.data + MLP_WEIGHTS_HEADER_SIZE);
+    int valid = file.size >= MLP_WEIGHTS_HEADER_SIZE && memcmp(header->magic, MLP_WEIGHTS_MAGIC, 4) == 0 &&
+                valid_weights_header(header, NULL) &&
+                file.size >= MLP_WEIGHTS_HEADER_SIZE + header->num_layers * sizeof(uint32_t) &&
+                valid_weights_header(header, layers) &&
+                header->payload_offset % MLP_WEIGHTS_ALIGNMENT == 0 &&
+                header->payload_offset >= weights_payload_offset(header->num_layers) &&
+                header->payload_offset <= file.size && header->payload_size <= file.size - header->payload_offset;
+    if (!valid) {
+        mlp_log(MLP_LOG_ERROR, "%s is not a valid version %d weights file", file_path, MLP_WEIGHTS_VERSION);
+    } else if (header->element_type != (sizeof(mlp_real) == sizeof(float) ? MLP_WEIGHTS_FLOAT32 : MLP_WEIGHTS_FLOAT64)) {
+        mlp_log(MLP_LOG_ERROR, "%s does not hold %s weights, it has to be loaded (converted)", file_path, MLP_REAL_NAME);
+        valid = 0;
+    } else {
+        valid = weights_shape_matches(mlp, num_of_hidden_layers, layers, header->num_layers, file_path);
+    }
+    //The weight matricies (of the network's shape by now) must be the whole payload
+    if (valid) {
+        uint64_t payload_size = 0;
+        for (unsigned int layer = 0; layer + 1 < header->num_layers; layer++)
+            payload_size += (uint64_t)layers[layer] * weights_stride(layers[layer + 1], sizeof(mlp_real)) * sizeof(mlp_real);
+        if (payload_size != header->payload_size) {
+            mlp_log(MLP_LOG_ERROR, "%s holds %llu bytes of weights but its layers need %llu", file_path,
+                    (unsigned long long)header->payload_size, (unsigned long long)payload_size);
+            valid = 0;
+        }
+    }
+
+    int num_weights = (int)num_of_hidden_layers + 1;
+    if (valid) {
+        //Point every matrix at its part of the payload
+        uint64_t offset = header->payload_offset;
+        mlp->weights = (Matrix*)calloc(num_weights, sizeof(Matrix));
+        valid = mlp->weights != NULL;
+        for (int layer = 0; valid && layer < num_weights; layer++) {
+            uint64_t size = (uint64_t)layers[layer] * weights_stride(layers[layer + 1], sizeof(mlp_real)) * sizeof(mlp_real);
+            valid = offset + size <= header->payload_offset + header->payload_size &&
+                    init_matrix_view(&mlp->weights[layer], layers[layer], layers[layer + 1], (mlp_real*)(file.data + offset));
+            offset += size;
+        }
+        if (!valid) {
+            mlp_log(MLP_LOG_ERROR, "Cannot map the weights from %s", file_path);
+            if (mlp->weights != NULL)
+                free_mat_array(&mlp->weights, num_weights);
+        }
+    }
+    if (!valid) {
+        unmap_file(&file);
+        return 0;
+    }
+    mlp->sigmoid_mode = (SigmoidMode)header->sigmoid_mode;
+    mlp->weights_file = file;
     return num_weights;
 }
 
+void
+free_mlp_weights(MLP_NN* mlp, size_t num_of_hidden_layers) {
+    if (mlp->weights != NULL)
+        free_mat_array(&mlp->weights, num_of_hidden_layers);
+    unmap_file(&mlp->weights_file);
+}
+
+size_t
+load_mlp_model(MLP_NN* mlp, const char* file_path, MLP_WeightsInfo* info) {
+    if (!read_mlp_weights_info(file_path, info))
+        return 0;
+    mlp->num_inputs = info->layers[0];
+    mlp->num_outputs = info->layers[info->num_layers - 1];
+    mlp->num_hidden = info->layers + 1;
+    return load_mlp_weights(mlp, file_path, info->num_layers - 2);
+}
+
 //Will deallocate the matrix arrays and set to NULL
 void free_mat_array(Matrix** weights, int num_weights) {
    // Free the weights
@@ -5,7 +5,12 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "matrix.h"
+#include "dataset.h"
+#include "log.h"
+#include "simd.h"
 
 //The Multilayer Perceptron struct
 typedef struct {
@@ -19,14 +24,118 @@ typedef struct {
     //The MLP nodes, weights and neurons (might change this later)
     Matrix* neurons;
     Matrix* weights;
+    //Samples stacked into each training step, the gradients are averaged over them (0 means 1)
+    int batch_size;
+    //Accuracy of the sigmoid activations (SIGMOID_ACCURATE when zero initialized)
+    SigmoidMode sigmoid_mode;
+    //Weights file the weights point into when mapped (see map_mlp_weights())
+    MappedFile weights_file;
 } MLP_NN;
 
-//Read the data set
+//Preplanned buffers for forward passes. The activations of every layer are sized once from the
+//network topology for up to max_rows input rows, after which mlp_plan_forward() does not touch
+//the heap
+typedef struct {
+    size_t num_of_hidden_layers;
+    int max_rows;
+    //Activations of every layer (num_of_hidden_layers + 1 matricies, the first holds the input)
+    Matrix* activations;
+} MLP_Plan;
+
+//Buffers used by a training step. They are sized once for the network and batch size so the
+//training loop never touches the heap
+typedef struct {
+    size_t num_of_hidden_layers;
+    int batch_size;
+    //The batch being trained on (one sample per row)
+    Matrix inputs;
+    Matrix outputs;
+    //Error of the current layer and the one propagated to the previous layer
+    Matrix error;
+    Matrix error_hidden;
+    //Error scaled by the sigmoid derivative (the weight gradient is nodes^T times this)
+    Matrix sig_derivative;
+} MLP_TrainWorkspace;
+
+//Where training samples come from: fetch() writes sample number 'sample' (of num_samples) into
+//inputs (num_inputs values) and outputs (num_outputs values). Lets the training loop read compact
+//storage such as a binary Dataset without expanding it to matricies first
+typedef struct {
+    int num_samples;
+    void (*fetch)(const void* ctx, int sample, mlp_real* inputs, mlp_real* outputs);
+    const void* ctx;
+} MLP_SampleSource;
+
+//== Weights files ==
+//A fixed header, the size of every layer and the weight matricies one after the other, all in
+//host byte order (little endian on x86). Each matrix is stored with the padded row stride of the
+//matrix storage (see matrix.h) and starts MLP_WEIGHTS_ALIGNMENT aligned, so the payload can be
+//used in place. Files without the magic are legacy ones: the rows as raw doubles, no header
+#define MLP_WEIGHTS_MAGIC "MLPW"
+#define MLP_WEIGHTS_VERSION 2
+#define MLP_WEIGHTS_HEADER_SIZE 64
+#define MLP_WEIGHTS_ALIGNMENT MATRIX_ALIGNMENT
+//Most layers (inputs and outputs included) a weights file describes
+#define MLP_MAX_LAYERS 64
+
+//Element types of the weights
+#define MLP_WEIGHTS_FLOAT64 1
+#define MLP_WEIGHTS_FLOAT32 2
+//Activations
+#define MLP_ACTIVATION_SIGMOID 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t element_type;
+    uint32_t activation;
+    uint32_t sigmoid_mode;
+    //Layers including the inputs and outputs (weight matricies + 1), their sizes follow the header
+    uint32_t num_layers;
+    //Where the weight matricies start and their total size in bytes
+    uint64_t payload_offset;
+    uint64_t payload_size;
+    //FNV-1a over 64-bit words of the payload, and of the header fields above and layer sizes
+    uint64_t payload_checksum;
+    uint64_t header_checksum;
+    uint64_t reserved;
+} MLP_WeightsHeader;
+
+//FNV-1a over 64-bit words (a trailing partial word is zero padded), the checksum of the weights
+//files. It can be updated piece by piece as long as every piece but the last is a multiple of 8
+//bytes, starting from WEIGHTS_CHECKSUM_SEED
+#define WEIGHTS_CHECKSUM_SEED 0xcbf29ce484222325ull
+uint64_t weights_checksum(uint64_t h, const void* data, size_t size);
+
+//Topology and settings of a weights file
+typedef struct {
+    unsigned int num_layers;
+    //Nodes on every layer: inputs, hidden layers, outputs
+    unsigned int layers[MLP_MAX_LAYERS];
+    size_t element_size;
+    SigmoidMode sigmoid_mode;
+} MLP_WeightsInfo;
+
+//Read the data set, a CSV file or a binary data set (see dataset.h), detected from its first bytes
 int read_dataset(const char* file_path, unsigned int num_inputs, unsigned int num_outputs, Matrix* input_nodes, Matrix* output_nodes);
 
+//Read rows [first_row, first_row + rows) of a CSV data set (clipped to its end, such as the rows
+//appended since the last run) without parsing the others, through its row index (see
+//dataset.h, built on first use). Returns the number of rows read, 0 on failure
+int read_dataset_rows(const char* file_path, int first_row, int rows, unsigned int num_inputs, unsigned int num_outputs,
+                      Matrix* input_nodes, Matrix* output_nodes);
+
+//Read the rows of one class of a CSV data set through its row index. Returns the number of rows
+//read, 0 on failure (or when the class has no rows)
+int read_dataset_class(const char* file_path, unsigned int label, unsigned int num_inputs, unsigned int num_outputs,
+                       Matrix* input_nodes, Matrix* output_nodes);
+
 //Our activation function to pass in
 void sigmoid(Matrix* mat);
 
+//Sigmoid with the chosen accuracy (see SigmoidMode in simd.h)
+void sigmoid_with_mode(Matrix* mat, SigmoidMode mode);
+
 //Initialize the weights for the model
 size_t initialize_rand_weights(MLP_NN* mlp, size_t num_of_hidden_layers);
 
@@ -39,15 +148,60 @@ void print_mlp_nn(MLP_NN* mlp, size_t num_of_hidden_layers);
 //Forward propgate (pass the inputs through the model)
 void forward_propagate(MLP_NN* mlp, Matrix* inputs_neurons, size_t num_of_hidden_layers);
 
-//Train the MLP model (backward and forward propgation)
+//Size a forward pass plan for the model (weights must be set), returns 0 on failure
+int init_mlp_plan(MLP_Plan* plan, MLP_NN* mlp, size_t num_of_hidden_layers, int max_rows);
+
+//Forward propagate through the plan without allocating, returns the output neurons (NULL if the
+//input does not fit the plan)
+Matrix* mlp_plan_forward(MLP_Plan* plan, MLP_NN* mlp, Matrix* inputs_neurons);
+
+//Free the plan buffers
+void free_mlp_plan(MLP_Plan* plan);
+
+//Size the training buffers for the model and its batch size (weights must be set), returns 0 on
+//failure
+int init_mlp_train_workspace(MLP_TrainWorkspace* ws, MLP_NN* mlp, size_t num_of_hidden_layers);
+
+//Free the training buffers
+void free_mlp_train_workspace(MLP_TrainWorkspace* ws);
+
+//Train the MLP model (backward and forward propgation), one batch of mlp->batch_size random
+//samples per epoch
 void train_mlp_model(MLP_NN* mlp, Matrix* inputs_neurons_dataset, Matrix* outputs_neurons_dataset, size_t num_of_hidden_layers);
 
-//Save the weights into a file
+//Train the MLP model on the samples of a source (same as train_mlp_model())
+void train_mlp_model_from_source(MLP_NN* mlp, const MLP_SampleSource* source, size_t num_of_hidden_layers);
+
+//Sample source reading straight from the 8-bit pixels of a binary data set
+MLP_SampleSource dataset_sample_source(const Dataset* dataset);
+
+//Save the weights into a file (the number of weight layers is passed)
 void save_mlp_weights(MLP_NN* mlp, const char* file_path, size_t num_of_hidden_layers);
 
-//Load the weights from a file
+//Load the weights from a file into a network of the given shape (the number of hidden layers is
+//passed). Returns the number of weight layers, 0 (with the weights left NULL) when the file cannot
+//be read, is damaged (checksums) or holds a network of another shape
 size_t load_mlp_weights(MLP_NN* mlp, const char* file_path, size_t num_of_hidden_layers);
 
+//Map a weights file read only and point the weight matricies straight at its payload instead of
+//reading it: startup costs a header check whatever the size of the network, and every process
+//mapping the same file shares one physical copy of the weights. The file must be a version 2
+//file of this build's precision and of the network's shape (the payload checksum is not checked,
+//that would read every page). Mapped weights cannot be trained; free them with
+//free_mlp_weights(). Returns the number of weight layers, 0 on failure
+size_t map_mlp_weights(MLP_NN* mlp, const char* file_path, size_t num_of_hidden_layers);
+
+//Free the weights (the number of weight layers is passed), unmapping their file when mapped
+void free_mlp_weights(MLP_NN* mlp, size_t num_of_hidden_layers);
+
+//Read the topology of a weights file, returns 0 for legacy files (which have none) and on failure
+int read_mlp_weights_info(const char* file_path, MLP_WeightsInfo* info);
+
+//Build the network from the weights file alone: its inputs, outputs and hidden layers (num_hidden
+//points into info, which must outlive the network) and weights. Returns the number of weight
+//layers, 0 on failure
+size_t load_mlp_model(MLP_NN* mlp, const char* file_path, MLP_WeightsInfo* info);
+
 //Will deallocate the matrix arrays and set to NULL
 void free_mat_array(Matrix** weights, int num_weights);
 
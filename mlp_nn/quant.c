@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "quant.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define QUANT_X86 1
+#include <immintrin.h>
+#endif
+
+//Rows of the calibration data set run through the network at a time
+#define QUANT_CALIBRATION_ROWS 256
+//Bytes before the output scales of a layer (its input scale, padded to a cache line)
+#define QUANT_LAYER_HEADER_SIZE MLP_WEIGHTS_ALIGNMENT
+
+typedef struct {
+    const char* name;
+    //c (rows x np) = a (rows x kp u8, lda apart) * w (kp x np s8, packed), rows is a multiple of
+    //QUANT_ROW_BLOCK
+    void (*gemm)(int rows, int kp, int np, const uint8_t* a, int lda, const int8_t* w, int32_t* c);
+    //a = x * inverse_scale rounded to the integer inputs (x >= 0)
+    void (*quantize)(int n, const mlp_real* x, mlp_real inverse_scale, uint8_t* a);
+} QuantKernels;
+
+//== Generic kernels ==
+
+static void
+generic_quant_gemm(int rows, int kp, int np, const uint8_t* a, int lda, const int8_t* w, int32_t* c) {
+    for (int r = 0; r < rows; r++) {
+        int32_t* cr = c + (size_t)r * np;
+        memset(cr, 0, np * sizeof(int32_t));
+        for (int g = 0; g < kp / QUANT_K_GROUP; g++) {
+            const uint8_t* ag = a + (size_t)r * lda + g * QUANT_K_GROUP;
+            const int8_t* wg = w + (size_t)g * np * QUANT_K_GROUP;
+            for (int j = 0; j < np; j++) {
+                for (int t = 0; t < QUANT_K_GROUP; t++)
+                    cr[j] += ag[t] * wg[j * QUANT_K_GROUP + t];
+            }
+        }
+    }
+}
+
+static void
+generic_quantize(int n, const mlp_real* x, mlp_real inverse_scale, uint8_t* a) {
+    for (int i = 0; i < n; i++) {
+        mlp_real v = x[i] * inverse_scale + (mlp_real)0.5;
+        v = v > 0 ? v : 0;
+        v = v < QUANT_ACTIVATION_MAX ? v : QUANT_ACTIVATION_MAX;
+        a[i] = (uint8_t)(int)v;
+    }
+}
+
+static const QuantKernels generic_quant_kernels = {"generic", generic_quant_gemm, generic_quantize};
+
+#ifdef QUANT_X86
+
+#define QUANT_CAT_(a, b) a##_##b
+#define QUANT_CAT(a, b) QUANT_CAT_(a, b)
+#define QUANT_FN(name) QUANT_CAT(QUANT_PREFIX, name)
+
+//== AVX2: pairs of products summed to int16 (vpmaddubsw, exact as the inputs stop at 7 bits) and
+//pairs of those to int32 ==
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+static inline __m256i
+avx2_dot_u8s8(__m256i c, __m256i a, __m256i b) {
+    __m256i pairs = _mm256_maddubs_epi16(a, b);
+    return _mm256_add_epi32(c, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+}
+
+#define QUANT_PREFIX avx2
+#define QUANT_DOT avx2_dot_u8s8
+#include "quant_kernels.inc"
+#undef QUANT_PREFIX
+#undef QUANT_DOT
+
+//8 inputs at a time, truncated (after adding 0.5) to int32 and packed down to bytes
+static void
+avx2_quantize(int n, const mlp_real* x, mlp_real inverse_scale, uint8_t* a) {
+    int i = 0;
+#ifdef MLP_FLOAT32
+    __m256 scale = _mm256_set1_ps(inverse_scale), half = _mm256_set1_ps(0.5f);
+    __m256 low = _mm256_setzero_ps(), high = _mm256_set1_ps(QUANT_ACTIVATION_MAX);
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x + i), scale), half);
+        __m256i q = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(v, low), high));
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+        _mm_storel_epi64((__m128i*)(a + i), _mm_packus_epi16(words, words));
+    }
+#else
+    __m256d scale = _mm256_set1_pd(inverse_scale), half = _mm256_set1_pd(0.5);
+    __m256d low = _mm256_setzero_pd(), high = _mm256_set1_pd(QUANT_ACTIVATION_MAX);
+    for (; i + 8 <= n; i += 8) {
+        __m256d v0 = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i), scale), half);
+        __m256d v1 = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i + 4), scale), half);
+        __m128i q0 = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(v0, low), high));
+        __m128i q1 = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(v1, low), high));
+        __m128i words = _mm_packs_epi32(q0, q1);
+        _mm_storel_epi64((__m128i*)(a + i), _mm_packus_epi16(words, words));
+    }
+#endif
+    generic_quantize(n - i, x + i, inverse_scale, a + i);
+}
+
+static const QuantKernels avx2_quant_kernels = {"avx2", avx2_gemm, avx2_quantize};
+
+#pragma GCC pop_options
+
+//== AVX-VNNI: the 4 products of a lane summed into it by one instruction (vpdpbusd) ==
+#pragma GCC push_options
+#pragma GCC target("avx2,avxvnni")
+
+#define QUANT_PREFIX avxvnni
+#define QUANT_DOT _mm256_dpbusd_avx_epi32
+#include "quant_kernels.inc"
+#undef QUANT_PREFIX
+#undef QUANT_DOT
+
+static const QuantKernels avxvnni_quant_kernels = {"avxvnni", avxvnni_gemm, avx2_quantize};
+
+#pragma GCC pop_options
+
+#endif
+
+//Pick the fastest kernel the CPU supports, capped by MLP_SIMD like the other kernels
+static const QuantKernels*
+select_quant_kernels(void) {
+#ifdef QUANT_X86
+    const char* env = getenv("MLP_SIMD");
+    int max_avx2 = env != NULL && strcmp(env, "avx2") == 0;
+    int max_generic = env != NULL && (strcmp(env, "generic") == 0 || strcmp(env, "sse2") == 0);
+    __builtin_cpu_init();
+    if (!max_generic && !max_avx2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avxvnni"))
+        return &avxvnni_quant_kernels;
+    if (!max_generic && __builtin_cpu_supports("avx2"))
+        return &avx2_quant_kernels;
+#endif
+    return &generic_quant_kernels;
+}
+
+static const QuantKernels*
+quant_kernels(void) {
+    static const QuantKernels* selected = NULL;
+    const QuantKernels* kernels = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (kernels == NULL) {
+        //Selecting is idempotent so threads racing here all store the same table
+        kernels = select_quant_kernels();
+        __atomic_store_n(&selected, kernels, __ATOMIC_RELEASE);
+    }
+    return kernels;
+}
+
+const char*
+quant_kernels_name(void) {
+    return quant_kernels()->name;
+}
+
+static int
+round_up(int n, int multiple) {
+    return (n + multiple - 1) / multiple * multiple;
+}
+
+//Bytes of a layer in the payload
+static size_t
+quant_layer_size(int padded_inputs, int padded_outputs) {
+    return QUANT_LAYER_HEADER_SIZE + padded_outputs * sizeof(float) + (size_t)padded_inputs * padded_outputs;
+}
+
+static size_t
+quant_payload_size(const QuantMLP* quant) {
+    size_t size = 0;
+    for (unsigned int l = 0; l < quant->num_layers; l++)
+        size += quant_layer_size(round_up(quant->layers[l], QUANT_K_GROUP), round_up(quant->layers[l + 1], QUANT_COLUMN_BLOCK));
+    return size;
+}
+
+//Point the layers into the payload (the input scales are read from it)
+static void
+point_quant_layers(QuantMLP* quant) {
+    char* p = (char*)quant->payload;
+    for (unsigned int l = 0; l < quant->num_layers; l++) {
+        QuantLayer* layer = &quant->quant_layers[l];
+        layer->inputs = quant->layers[l];
+        layer->outputs = quant->layers[l + 1];
+        layer->padded_inputs = round_up(layer->inputs, QUANT_K_GROUP);
+        layer->padded_outputs = round_up(layer->outputs, QUANT_COLUMN_BLOCK);
+        memcpy(&layer->input_scale, p, sizeof(float));
+        layer->weight_scales = (const float*)(p + QUANT_LAYER_HEADER_SIZE);
+        layer->weights = (const int8_t*)(p + QUANT_LAYER_HEADER_SIZE + layer->padded_outputs * sizeof(float));
+        p += quant_layer_size(layer->padded_inputs, layer->padded_outputs);
+    }
+}
+
+//Allocate the (zeroed) payload for the layer sizes
+static int
+alloc_quant_payload(QuantMLP* quant) {
+    quant->payload_size = quant_payload_size(quant);
+    if (posix_memalign(&quant->payload, MLP_WEIGHTS_ALIGNMENT, quant->payload_size) != 0) {
+        quant->payload = NULL;
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate %zu bytes of int8 weights", quant->payload_size);
+        return 0;
+    }
+    memset(quant->payload, 0, quant->payload_size);
+    return 1;
+}
+
+//Largest input of every layer over the calibration rows
+static int
+calibrate_inputs(MLP_NN* mlp, size_t num_of_hidden_layers, Matrix* calibration, double* max_inputs) {
+    MLP_Plan plan;
+    int batch_rows = calibration->rows < QUANT_CALIBRATION_ROWS ? calibration->rows : QUANT_CALIBRATION_ROWS;
+    if (!init_mlp_plan(&plan, mlp, num_of_hidden_layers, batch_rows))
+        return 0;
+    Matrix batch;
+    init_matrix(&batch, batch_rows, calibration->columns);
+
+    for (size_t l = 0; l < num_of_hidden_layers; l++)
+        max_inputs[l] = 0.0;
+    for (int first = 0; first < calibration->rows; first += batch_rows) {
+        int rows = calibration->rows - first < batch_rows ? calibration->rows - first : batch_rows;
+        resize_matrix(&batch, rows, calibration->columns);
+        for (int r = 0; r < rows; r++)
+            memcpy(matrix_row(&batch, r), matrix_row(calibration, first + r), calibration->columns * sizeof(mlp_real));
+        mlp_plan_forward(&plan, mlp, &batch);
+        //The activations of layer l are the inputs of weight layer l
+        for (size_t l = 0; l < num_of_hidden_layers; l++) {
+            Matrix* inputs = &plan.activations[l];
+            for (int r = 0; r < inputs->rows; r++) {
+                const mlp_real* row = matrix_row(inputs, r);
+                for (int k = 0; k < inputs->columns; k++) {
+                    if (row[k] > max_inputs[l])
+                        max_inputs[l] = row[k];
+                }
+            }
+        }
+    }
+
+    free_matrix(&batch);
+    free_mlp_plan(&plan);
+    return 1;
+}
+
+int
+quantize_mlp(QuantMLP* quant, MLP_NN* mlp, size_t num_of_hidden_layers, Matrix* calibration) {
+    memset(quant, 0, sizeof(QuantMLP));
+    if (num_of_hidden_layers == 0 || num_of_hidden_layers >= MLP_MAX_LAYERS || mlp->weights == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot quantize a network of %zu weight layers", num_of_hidden_layers);
+        return 0;
+    }
+    if (calibration->rows == 0 || calibration->columns != (int)mlp->num_inputs) {
+        mlp_log(MLP_LOG_ERROR, "Calibration set of %d x %d does not fit a network of %u inputs",
+                calibration->rows, calibration->columns, mlp->num_inputs);
+        return 0;
+    }
+
+    quant->num_layers = num_of_hidden_layers;
+    quant->layers[0] = mlp->num_inputs;
+    for (size_t l = 0; l < num_of_hidden_layers; l++)
+        quant->layers[l + 1] = mlp->weights[l].columns;
+    quant->sigmoid_mode = mlp->sigmoid_mode;
+
+    double max_inputs[MLP_MAX_LAYERS];
+    if (!calibrate_inputs(mlp, num_of_hidden_layers, calibration, max_inputs) || !alloc_quant_payload(quant))
+        return 0;
+
+    char* p = (char*)quant->payload;
+    for (size_t l = 0; l < num_of_hidden_layers; l++) {
+        Matrix* weights = &mlp->weights[l];
+        int padded_inputs = round_up(weights->rows, QUANT_K_GROUP);
+        int padded_outputs = round_up(weights->columns, QUANT_COLUMN_BLOCK);
+        float input_scale = (float)(max_inputs[l] > 0.0 ? max_inputs[l] / QUANT_ACTIVATION_MAX : 1.0 / QUANT_ACTIVATION_MAX);
+        memcpy(p, &input_scale, sizeof(float));
+        float* weight_scales = (float*)(p + QUANT_LAYER_HEADER_SIZE);
+        int8_t* packed = (int8_t*)(p + QUANT_LAYER_HEADER_SIZE + padded_outputs * sizeof(float));
+
+        //Symmetric scale of every output channel from its largest weight
+        for (int j = 0; j < weights->columns; j++) {
+            double max_weight = 0.0;
+            for (int k = 0; k < weights->rows; k++)
+                max_weight = fmax(max_weight, fabs(weights->data[k][j]));
+            double scale = max_weight > 0.0 ? max_weight / QUANT_WEIGHT_MAX : 1.0;
+            weight_scales[j] = (float)scale;
+            for (int k = 0; k < weights->rows; k++) {
+                long q = lrint(weights->data[k][j] / scale);
+                q = q > QUANT_WEIGHT_MAX ? QUANT_WEIGHT_MAX : q < -QUANT_WEIGHT_MAX ? -QUANT_WEIGHT_MAX : q;
+                packed[((size_t)(k / QUANT_K_GROUP) * padded_outputs + j) * QUANT_K_GROUP + k % QUANT_K_GROUP] = (int8_t)q;
+            }
+        }
+        p += quant_layer_size(padded_inputs, padded_outputs);
+    }
+
+    point_quant_layers(quant);
+    return 1;
+}
+
+//Header checksum: the fixed fields (without the checksum itself) and the layer sizes
+static uint64_t
+quant_header_checksum(const MLP_WeightsHeader* header, const uint32_t* layers) {
+    uint64_t h = weights_checksum(WEIGHTS_CHECKSUM_SEED, header, offsetof(MLP_WeightsHeader, header_checksum));
+    return weights_checksum(h, layers, header->num_layers * sizeof(uint32_t));
+}
+
+int
+save_quant_mlp(const QuantMLP* quant, const char* file_path) {
+    FILE* file = fopen(file_path, "wb");
+    if (file == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot write to file %s", file_path);
+        return 0;
+    }
+
+    uint32_t layers[MLP_MAX_LAYERS];
+    for (unsigned int l = 0; l <= quant->num_layers; l++)
+        layers[l] = quant->layers[l];
+    MLP_WeightsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, QUANT_MAGIC, 4);
+    header.version = QUANT_VERSION;
+    header.element_type = MLP_WEIGHTS_INT8;
+    header.activation = MLP_ACTIVATION_SIGMOID;
+    header.sigmoid_mode = quant->sigmoid_mode;
+    header.num_layers = quant->num_layers + 1;
+    size_t table_size = header.num_layers * sizeof(uint32_t);
+    header.payload_offset = round_up(MLP_WEIGHTS_HEADER_SIZE + table_size, MLP_WEIGHTS_ALIGNMENT);
+    header.payload_size = quant->payload_size;
+    header.payload_checksum = weights_checksum(WEIGHTS_CHECKSUM_SEED, quant->payload, quant->payload_size);
+    header.header_checksum = quant_header_checksum(&header, layers);
+
+    static const unsigned char padding[MLP_WEIGHTS_ALIGNMENT] = {0};
+    size_t padding_size = header.payload_offset - MLP_WEIGHTS_HEADER_SIZE - table_size;
+    int written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(layers, 1, table_size, file) == table_size &&
+                  fwrite(padding, 1, padding_size, file) == padding_size &&
+                  fwrite(quant->payload, 1, quant->payload_size, file) == quant->payload_size;
+    if (fclose(file) != 0 || !written) {
+        mlp_log(MLP_LOG_ERROR, "Cannot write the int8 weights to %s", file_path);
+        return 0;
+    }
+    mlp_log(MLP_LOG_INFO, "Saved %u int8 weight layers to %s", quant->num_layers, file_path);
+    return 1;
+}
+
+int
+load_quant_mlp(QuantMLP* quant, const char* file_path) {
+    memset(quant, 0, sizeof(QuantMLP));
+    FILE* file = fopen(file_path, "rb");
+    if (file == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot read from file %s", file_path);
+        return 0;
+    }
+
+    MLP_WeightsHeader header;
+    uint32_t layers[MLP_MAX_LAYERS];
+    int valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, QUANT_MAGIC, 4) == 0 &&
+                header.version == QUANT_VERSION && header.num_layers >= 2 && header.num_layers <= MLP_MAX_LAYERS &&
+                fread(layers, sizeof(uint32_t), header.num_layers, file) == header.num_layers &&
+                header.header_checksum == quant_header_checksum(&header, layers) &&
+                header.element_type == MLP_WEIGHTS_INT8 && header.activation == MLP_ACTIVATION_SIGMOID;
+    if (valid) {
+        quant->num_layers = header.num_layers - 1;
+        for (unsigned int l = 0; l < header.num_layers; l++) {
+            quant->layers[l] = layers[l];
+            valid = valid && layers[l] > 0;
+        }
+        quant->sigmoid_mode = (SigmoidMode)header.sigmoid_mode;
+        valid = valid && header.payload_size == quant_payload_size(quant) && fseek(file, header.payload_offset, SEEK_SET) == 0;
+    }
+    if (!valid) {
+        mlp_log(MLP_LOG_ERROR, "%s is not a valid int8 weights file", file_path);
+        fclose(file);
+        return 0;
+    }
+
+    valid = alloc_quant_payload(quant) && fread(quant->payload, 1, quant->payload_size, file) == quant->payload_size;
+    fclose(file);
+    if (valid && weights_checksum(WEIGHTS_CHECKSUM_SEED, quant->payload, quant->payload_size) != header.payload_checksum) {
+        mlp_log(MLP_LOG_ERROR, "%s is damaged (checksum mismatch)", file_path);
+        valid = 0;
+    }
+    if (!valid) {
+        free_quant_mlp(quant);
+        return 0;
+    }
+    point_quant_layers(quant);
+    mlp_log(MLP_LOG_INFO, "Loaded %u int8 weight layers from %s", quant->num_layers, file_path);
+    return 1;
+}
+
+void
+free_quant_mlp(QuantMLP* quant) {
+    free(quant->payload);
+    quant->payload = NULL;
+    quant->payload_size = 0;
+}
+
+int
+init_quant_plan(QuantPlan* plan, const QuantMLP* quant, int max_rows) {
+    memset(plan, 0, sizeof(QuantPlan));
+    plan->max_rows = max_rows;
+    int blocked_rows = round_up(max_rows, QUANT_ROW_BLOCK);
+    int max_outputs = 0;
+    int valid = 1;
+    for (unsigned int l = 0; l < quant->num_layers; l++) {
+        const QuantLayer* layer = &quant->quant_layers[l];
+        size_t size = (size_t)blocked_rows * layer->padded_inputs;
+        void* activations;
+        if (posix_memalign(&activations, MLP_WEIGHTS_ALIGNMENT, size) != 0) {
+            valid = 0;
+            break;
+        }
+        //The padding columns stay zero
+        memset(activations, 0, size);
+        plan->activations[l] = (uint8_t*)activations;
+        if (layer->padded_outputs > max_outputs)
+            max_outputs = layer->padded_outputs;
+    }
+
+    void* sums = NULL;
+    if (valid && posix_memalign(&sums, MLP_WEIGHTS_ALIGNMENT, (size_t)blocked_rows * max_outputs * sizeof(int32_t)) != 0)
+        valid = 0;
+    plan->sums = (int32_t*)sums;
+    plan->row = valid ? (mlp_real*)malloc(max_outputs * sizeof(mlp_real)) : NULL;
+    if (valid)
+        init_matrix(&plan->outputs, max_rows, quant->layers[quant->num_layers]);
+    if (!valid || plan->row == NULL || plan->outputs.buffer == NULL) {
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate the int8 forward pass plan");
+        free_quant_plan(plan);
+        return 0;
+    }
+    return 1;
+}
+
+Matrix*
+quant_forward(QuantPlan* plan, const QuantMLP* quant, Matrix* inputs) {
+    const QuantLayer* first = &quant->quant_layers[0];
+    if (inputs->rows > plan->max_rows || inputs->columns != first->inputs) {
+        mlp_log(MLP_LOG_ERROR, "Input of %d x %d does not fit the int8 plan (%d x %d)",
+                inputs->rows, inputs->columns, plan->max_rows, first->inputs);
+        return NULL;
+    }
+    const QuantKernels* kernels = quant_kernels();
+    SigmoidKernel activation = simd_sigmoid_kernel(simd_kernels(), quant->sigmoid_mode);
+    int rows = inputs->rows;
+    int blocked_rows = round_up(rows, QUANT_ROW_BLOCK);
+    resize_matrix(&plan->outputs, rows, quant->layers[quant->num_layers]);
+
+    mlp_real inverse_scale = (mlp_real)(1.0 / first->input_scale);
+    for (int r = 0; r < rows; r++) {
+        kernels->quantize(first->inputs, matrix_row(inputs, r), inverse_scale,
+                          plan->activations[0] + (size_t)r * first->padded_inputs);
+    }
+
+    for (unsigned int l = 0; l < quant->num_layers; l++) {
+        const QuantLayer* layer = &quant->quant_layers[l];
+        int last = l + 1 == quant->num_layers;
+        //Rows past the inputs hold whatever the previous passes left, their sums are not used
+        kernels->gemm(blocked_rows, layer->padded_inputs, layer->padded_outputs, plan->activations[l],
+                      layer->padded_inputs, layer->weights, plan->sums);
+
+        const QuantLayer* next = last ? NULL : &quant->quant_layers[l + 1];
+        if (next != NULL)
+            inverse_scale = (mlp_real)(1.0 / next->input_scale);
+        for (int r = 0; r < rows; r++) {
+            const int32_t* sums = plan->sums + (size_t)r * layer->padded_outputs;
+            mlp_real* out = last ? matrix_row(&plan->outputs, r) : plan->row;
+            for (int j = 0; j < layer->outputs; j++)
+                out[j] = sums[j] * ((mlp_real)layer->input_scale * layer->weight_scales[j]);
+            activation(layer->outputs, out);
+            if (next != NULL)
+                kernels->quantize(layer->outputs, out, inverse_scale, plan->activations[l + 1] + (size_t)r * next->padded_inputs);
+        }
+    }
+    return &plan->outputs;
+}
+
+void
+free_quant_plan(QuantPlan* plan) {
+    for (int l = 0; l < MLP_MAX_LAYERS - 1; l++) {
+        free(plan->activations[l]);
+        plan->activations[l] = NULL;
+    }
+    free(plan->sums);
+    free(plan->row);
+    plan->sums = NULL;
+    plan->row = NULL;
+    free_matrix(&plan->outputs);
+}
@@ -0,0 +1,100 @@
+#ifndef QUANT_H_
+#define QUANT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mlp_nn.h"
+
+//Int8 post-training quantization of a trained network for inference. Every weight column (output
+//channel) gets its own scale and is rounded to int8, the activations entering each layer are
+//rounded to 7-bit unsigned integers with a scale calibrated on a data set. A layer is then an
+//integer product (exact int32 sums of u8 * s8 products, 4 per instruction with VNNI) followed by
+//one multiply per output to get back to real numbers, the sigmoid and the rounding for the next
+//layer. The weights are 8x smaller than in double precision.
+//
+//The activations stop at 7 bits so the AVX2 kernel (vpmaddubsw, which saturates pairs of products
+//to 16 bits) computes exactly what the VNNI kernel does: every instruction set gives the same
+//result.
+
+#define QUANT_WEIGHT_MAX 127
+#define QUANT_ACTIVATION_MAX 127
+//Inputs are multiplied in groups of 4 (the bytes of an int32 lane) and outputs in blocks of 16 (two
+//AVX2 vectors of int32), layers are padded with zeros to multiples of these
+#define QUANT_K_GROUP 4
+#define QUANT_COLUMN_BLOCK 16
+//Rows (samples) multiplied together, sharing every weight load
+#define QUANT_ROW_BLOCK 4
+
+//== Int8 weights files ==
+//The header of the weights files (see mlp_nn.h) with QUANT_MAGIC and element_type
+//MLP_WEIGHTS_INT8, the size of every layer and then, for every weight layer (K inputs padded to
+//Kp, N outputs padded to Np), MLP_WEIGHTS_ALIGNMENT aligned:
+//  64 bytes: float scale of the layer inputs, then zeros
+//  Np floats: scale of every output channel (weight column)
+//  Kp / QUANT_K_GROUP x Np x QUANT_K_GROUP int8 weights: for each group of 4 inputs, the 4
+//  weights of every output one after the other (the layout of the kernels)
+#define QUANT_MAGIC "MLPQ"
+#define QUANT_VERSION 1
+#define MLP_WEIGHTS_INT8 3
+
+typedef struct {
+    //Inputs and outputs, and both padded
+    int inputs;
+    int outputs;
+    int padded_inputs;
+    int padded_outputs;
+    //Real input = input_scale * integer input, real weight = weight_scales[j] * integer weight
+    float input_scale;
+    const float* weight_scales;
+    const int8_t* weights;
+} QuantLayer;
+
+typedef struct {
+    //Weight layers and the nodes of every layer (inputs, hidden layers, outputs)
+    unsigned int num_layers;
+    unsigned int layers[MLP_MAX_LAYERS];
+    QuantLayer quant_layers[MLP_MAX_LAYERS - 1];
+    SigmoidMode sigmoid_mode;
+    //Storage of the scales and weights of every layer (laid out as in the file)
+    void* payload;
+    size_t payload_size;
+} QuantMLP;
+
+//Quantize the weights of the network (num_of_hidden_layers weight layers are passed). The scale of
+//the inputs of every layer comes from the largest activation the calibration inputs (one sample
+//per row, in batches) produce on it. Returns 0 on failure
+int quantize_mlp(QuantMLP* quant, MLP_NN* mlp, size_t num_of_hidden_layers, Matrix* calibration);
+
+//Write the quantized network, returns 0 on failure
+int save_quant_mlp(const QuantMLP* quant, const char* file_path);
+
+//Read a quantized network (checking its checksums), returns 0 (after printing why) on failure
+int load_quant_mlp(QuantMLP* quant, const char* file_path);
+
+void free_quant_mlp(QuantMLP* quant);
+
+//Buffers of the integer forward pass, sized for up to max_rows samples
+typedef struct {
+    int max_rows;
+    //Integer inputs of every layer (max_rows rounded up to QUANT_ROW_BLOCK rows of padded_inputs)
+    uint8_t* activations[MLP_MAX_LAYERS - 1];
+    //Sums of the product and a row of real outputs of the current layer
+    int32_t* sums;
+    mlp_real* row;
+    //Outputs of the network (one row per sample)
+    Matrix outputs;
+} QuantPlan;
+
+int init_quant_plan(QuantPlan* plan, const QuantMLP* quant, int max_rows);
+
+//Forward pass of the inputs (one sample per row, values in [0, 1] like the data sets), returns the
+//outputs (after the sigmoid) or NULL when the inputs do not fit the plan
+Matrix* quant_forward(QuantPlan* plan, const QuantMLP* quant, Matrix* inputs);
+
+void free_quant_plan(QuantPlan* plan);
+
+//Name of the integer kernels in use ("avxvnni", "avx2" or "generic"). MLP_SIMD=avx2, sse2 or
+//generic caps the choice like for the other kernels (see simd.h)
+const char* quant_kernels_name(void);
+
+#endif
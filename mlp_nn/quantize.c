@@ -0,0 +1,156 @@
+#include <sys/stat.h>
+#include "quant.h"
+
+//Quantize a weights file to int8 (see quant.h), calibrating the activations on a data set, and
+//report how the int8 network compares to the original one (accuracy, agreement, largest output
+//difference and images/s on one core) on the calibration set and an evaluation set:
+//  ./quantize <weights> <calibration data set> <int8 weights> [evaluation data set]
+
+#define EVAL_ROWS 64
+//Inference is repeated for at least this long to time it
+#define EVAL_MIN_SECONDS 0.5
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long file_size(const char* file_path) {
+    struct stat st;
+    return stat(file_path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+static int argmax(const mlp_real* row, int n) {
+    int best = 0;
+    for (int j = 1; j < n; j++) {
+        if (row[j] > row[best])
+            best = j;
+    }
+    return best;
+}
+
+typedef struct {
+    int correct;
+    int quant_correct;
+    int agree;
+    double max_diff;
+    double images_per_second;
+    double quant_images_per_second;
+} Comparison;
+
+//Forward pass of every sample through both networks, in batches of EVAL_ROWS. Timed passes do not
+//look at the outputs
+static void run_batches(MLP_NN* mlp, MLP_Plan* plan, const QuantMLP* quant, QuantPlan* quant_plan, Matrix* inputs,
+                        Matrix* outputs, Matrix* batch, Comparison* comparison) {
+    for (int first = 0; first < inputs->rows; first += EVAL_ROWS) {
+        int rows = inputs->rows - first < EVAL_ROWS ? inputs->rows - first : EVAL_ROWS;
+        resize_matrix(batch, rows, inputs->columns);
+        for (int r = 0; r < rows; r++)
+            memcpy(matrix_row(batch, r), matrix_row(inputs, first + r), inputs->columns * sizeof(mlp_real));
+        Matrix* predicted = plan != NULL ? mlp_plan_forward(plan, mlp, batch) : NULL;
+        Matrix* quant_predicted = quant_plan != NULL ? quant_forward(quant_plan, quant, batch) : NULL;
+        if (comparison == NULL)
+            continue;
+        for (int r = 0; r < rows; r++) {
+            const mlp_real* row = matrix_row(predicted, r);
+            const mlp_real* quant_row = matrix_row(quant_predicted, r);
+            int label = argmax(matrix_row(outputs, first + r), outputs->columns);
+            int best = argmax(row, predicted->columns);
+            int quant_best = argmax(quant_row, quant_predicted->columns);
+            comparison->correct += best == label;
+            comparison->quant_correct += quant_best == label;
+            comparison->agree += best == quant_best;
+            for (int j = 0; j < predicted->columns; j++)
+                comparison->max_diff = fmax(comparison->max_diff, fabs(row[j] - quant_row[j]));
+        }
+    }
+}
+
+//Images per second of one of the networks over the inputs
+static double time_batches(MLP_NN* mlp, MLP_Plan* plan, const QuantMLP* quant, QuantPlan* quant_plan, Matrix* inputs, Matrix* batch) {
+    long images = 0;
+    double start = now_seconds(), seconds;
+    do {
+        run_batches(mlp, plan, quant, quant_plan, inputs, NULL, batch, NULL);
+        images += inputs->rows;
+        seconds = now_seconds() - start;
+    } while (seconds < EVAL_MIN_SECONDS);
+    return images / seconds;
+}
+
+static int compare(MLP_NN* mlp, size_t num_weight_layers, const QuantMLP* quant, const char* dataset_path) {
+    Matrix inputs, outputs;
+    if (!read_dataset(dataset_path, mlp->num_inputs, mlp->num_outputs, &inputs, &outputs))
+        return 0;
+
+    MLP_Plan plan;
+    QuantPlan quant_plan;
+    Matrix batch;
+    Comparison comparison = {0};
+    int ready = init_mlp_plan(&plan, mlp, num_weight_layers, EVAL_ROWS);
+    if (ready && !init_quant_plan(&quant_plan, quant, EVAL_ROWS)) {
+        free_mlp_plan(&plan);
+        ready = 0;
+    }
+    if (ready) {
+        init_matrix(&batch, EVAL_ROWS, inputs.columns);
+        run_batches(mlp, &plan, quant, &quant_plan, &inputs, &outputs, &batch, &comparison);
+        comparison.images_per_second = time_batches(mlp, &plan, quant, NULL, &inputs, &batch);
+        comparison.quant_images_per_second = time_batches(mlp, NULL, quant, &quant_plan, &inputs, &batch);
+
+        int n = inputs.rows;
+        printf("%s (%d samples)\n", dataset_path, n);
+        printf("  accuracy   %s %6.2f%%   int8 %6.2f%%\n", MLP_REAL_NAME, 100.0 * comparison.correct / n, 100.0 * comparison.quant_correct / n);
+        printf("  agreement  %.2f%% of the predictions, largest output difference %.2e\n", 100.0 * comparison.agree / n, comparison.max_diff);
+        printf("  images/s   %s %10.0f   int8 %10.0f   (%.1fx)\n", MLP_REAL_NAME, comparison.images_per_second,
+               comparison.quant_images_per_second, comparison.quant_images_per_second / comparison.images_per_second);
+        free_matrix(&batch);
+        free_quant_plan(&quant_plan);
+        free_mlp_plan(&plan);
+    }
+    free_matrix(&inputs);
+    free_matrix(&outputs);
+    return ready;
+}
+
+int
+main(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <weights> <calibration data set> <int8 weights> [evaluation data set]\n", argv[0]);
+        return 1;
+    }
+    const char* eval_path = argc > 4 ? argv[4] : "../dataset/test.data";
+
+    MLP_NN mlp = {0};
+    MLP_WeightsInfo info;
+    size_t num_weight_layers = load_mlp_model(&mlp, argv[1], &info);
+    if (num_weight_layers == 0)
+        return 1;
+
+    //Calibrate, save and read back the file (so the report is for what was written)
+    Matrix calibration, calibration_outputs;
+    QuantMLP quant;
+    int quantized = read_dataset(argv[2], mlp.num_inputs, mlp.num_outputs, &calibration, &calibration_outputs);
+    if (quantized) {
+        quantized = quantize_mlp(&quant, &mlp, num_weight_layers, &calibration) && save_quant_mlp(&quant, argv[3]);
+        free_quant_mlp(&quant);
+        free_matrix(&calibration);
+        free_matrix(&calibration_outputs);
+    }
+    if (!quantized || !load_quant_mlp(&quant, argv[3])) {
+        free_mat_array(&mlp.weights, num_weight_layers);
+        return 1;
+    }
+
+    printf("Weights: %ld bytes as %s, %ld bytes as int8 (%.1fx smaller)\n", file_size(argv[1]),
+           info.element_size == sizeof(float) ? "float32" : "float64",
+           file_size(argv[3]), (double)file_size(argv[1]) / file_size(argv[3]));
+    printf("Kernels: %s (%s) and int8 %s\n", simd_kernels()->name, MLP_REAL_NAME, quant_kernels_name());
+    int compared = compare(&mlp, num_weight_layers, &quant, argv[2]);
+    compared = compare(&mlp, num_weight_layers, &quant, eval_path) && compared;
+
+    free_quant_mlp(&quant);
+    free_mat_array(&mlp.weights, num_weight_layers);
+    return compared ? 0 : 1;
+}
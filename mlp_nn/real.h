@@ -0,0 +1,15 @@
+#ifndef REAL_H_
+#define REAL_H_
+
+//Element type of the matricies, weights and activations. Building with -DMLP_FLOAT32 switches the
+//whole network to single precision, which doubles the lanes of every vector kernel and halves the
+//memory traffic. The default stays double precision
+#ifdef MLP_FLOAT32
+typedef float mlp_real;
+#define MLP_REAL_NAME "float32"
+#else
+typedef double mlp_real;
+#define MLP_REAL_NAME "float64"
+#endif
+
+#endif
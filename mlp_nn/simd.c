@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+//== Generic kernels (plain C, used when no vector instruction set is available) ==
+
+#define GENERIC_MR 4
+#define GENERIC_NR 8
+
+static void generic_gemm_micro_kernel(int kc, const mlp_real* a, const mlp_real* b, mlp_real* c, int ldc, int rows, int cols) {
+    mlp_real acc[GENERIC_MR][GENERIC_NR] = {{0.0}};
+
+    for (int p = 0; p < kc; p++) {
+        for (int i = 0; i < GENERIC_MR; i++) {
+            mlp_real a_ip = a[i];
+            for (int j = 0; j < GENERIC_NR; j++)
+                acc[i][j] += a_ip * b[j];
+        }
+        a += GENERIC_MR;
+        b += GENERIC_NR;
+    }
+
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++)
+            c[(size_t)i * ldc + j] += acc[i][j];
+    }
+}
+
+static void generic_axpy4(int n, const mlp_real* a, const mlp_real* b0, const mlp_real* b1, const mlp_real* b2, const mlp_real* b3, mlp_real* y) {
+    for (int j = 0; j < n; j++)
+        y[j] += a[0] * b0[j] + a[1] * b1[j] + a[2] * b2[j] + a[3] * b3[j];
+}
+
+static void generic_axpy(int n, mlp_real alpha, const mlp_real* x, mlp_real* y) {
+    for (int j = 0; j < n; j++)
+        y[j] += alpha * x[j];
+}
+
+static mlp_real generic_dot(int n, const mlp_real* x, const mlp_real* y) {
+    mlp_real sum = 0.0;
+    for (int j = 0; j < n; j++)
+        sum += x[j] * y[j];
+    return sum;
+}
+
+static void generic_subtract(int n, const mlp_real* a, const mlp_real* b, mlp_real* c) {
+    for (int j = 0; j < n; j++)
+        c[j] = a[j] - b[j];
+}
+
+static void generic_sigmoid(int n, mlp_real* x) {
+    for (int j = 0; j < n; j++)
+        x[j] = 1 / (1 + exp(-x[j]));
+}
+
+static void generic_sigmoid_grad(int n, const mlp_real* y, const mlp_real* err, mlp_real* out) {
+    for (int j = 0; j < n; j++)
+        out[j] = err[j] * y[j] * (1 - y[j]);
+}
+
+static const SimdKernels generic_kernels = {
+    SIMD_GENERIC,
+    "generic",
+    GENERIC_MR,
+    GENERIC_NR,
+    generic_gemm_micro_kernel,
+    generic_axpy4,
+    generic_axpy,
+    generic_dot,
+    generic_subtract,
+    generic_sigmoid,
+    generic_sigmoid,
+    generic_sigmoid_grad
+};
+
+#ifdef SIMD_X86
+
+//Constants for the vector e^x in simd_kernels.inc. The clamp keeps 2^n a normal number of
+//mlp_real and the series is cut where its truncation error drops below the precision of mlp_real
+#ifdef MLP_FLOAT32
+#define EXP_MIN_ARG -87.0
+#define EXP_MAX_ARG 88.0
+#define EXP_TAYLOR_TERMS 8
+#else
+#define EXP_MIN_ARG -708.0
+#define EXP_MAX_ARG 709.0
+#define EXP_TAYLOR_TERMS 13
+#endif
+#define EXP_LOG2E 1.4426950408889634
+#define EXP_LN2_HI 0.693145751953125
+#define EXP_LN2_LO 1.42860682030941723212e-6
+//Terms of the series for SIGMOID_FAST (up to r^5, sigmoid error below 3.5e-6)
+#define EXP_FAST_TERMS 6
+//1/12!, 1/11!, ... 1/1!, 1/0! (highest order first for Horner's scheme), a series of t terms uses
+//the last t entries
+static const mlp_real exp_taylor[13] = {
+    2.08767569878680989792e-9, 2.50521083854417187751e-8, 2.75573192239858906526e-7,
+    2.75573192239858906526e-6, 2.48015873015873015873e-5, 1.98412698412698412698e-4,
+    1.38888888888888888889e-3, 8.33333333333333333333e-3, 4.16666666666666666667e-2,
+    1.66666666666666666667e-1, 0.5, 1.0, 1.0
+};
+
+#define SIMD_CAT_(a, b) a##_##b
+#define SIMD_CAT(a, b) SIMD_CAT_(a, b)
+#define SIMD_FN(name) SIMD_CAT(SIMD_PREFIX, name)
+
+//Intrinsic of the element type, e.g. SIMD_PS_PD(_mm_add) is _mm_add_pd (or _mm_add_ps for float)
+#ifdef MLP_FLOAT32
+#define SIMD_PS_PD(name) name##_ps
+#else
+#define SIMD_PS_PD(name) name##_pd
+#endif
+
+//The GEMM tiles below are two vectors wide, so their columns double in single precision
+
+//== SSE2 (baseline of every x86-64 CPU), 4x4 GEMM tile (4x8 in single precision) ==
+#pragma GCC push_options
+#pragma GCC target("sse2")
+
+//p * 2^n, the exponent is built from n as an integer and shifted into place
+#ifdef MLP_FLOAT32
+static inline __m128 sse2_scale2n(__m128 p, __m128 n) {
+    __m128i i = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(i));
+}
+#define V __m128
+#define VROUND(x) _mm_cvtepi32_ps(_mm_cvtps_epi32(x))
+#else
+static inline __m128d sse2_scale2n(__m128d p, __m128d n) {
+    __m128i i = _mm_cvtpd_epi32(n);
+    i = _mm_unpacklo_epi32(i, _mm_srai_epi32(i, 31));
+    i = _mm_slli_epi64(_mm_add_epi64(i, _mm_set1_epi64x(1023)), 52);
+    return _mm_mul_pd(p, _mm_castsi128_pd(i));
+}
+#define V __m128d
+#define VROUND(x) _mm_cvtepi32_pd(_mm_cvtpd_epi32(x))
+#endif
+
+#define SIMD_PREFIX sse2
+#define SIMD_LEVEL SIMD_SSE2
+#define SIMD_NAME "sse2"
+#define VL (16 / (int)sizeof(mlp_real))
+#define SIMD_MR 4
+#define SIMD_NR (2 * VL)
+#define VLOAD(p) SIMD_PS_PD(_mm_loadu)(p)
+#define VSTORE(p, v) SIMD_PS_PD(_mm_storeu)(p, v)
+#define VSET1(x) SIMD_PS_PD(_mm_set1)(x)
+#define VZERO SIMD_PS_PD(_mm_setzero)()
+#define VADD(a, b) SIMD_PS_PD(_mm_add)(a, b)
+#define VSUB(a, b) SIMD_PS_PD(_mm_sub)(a, b)
+#define VMUL(a, b) SIMD_PS_PD(_mm_mul)(a, b)
+#define VDIV(a, b) SIMD_PS_PD(_mm_div)(a, b)
+#define VMIN(a, b) SIMD_PS_PD(_mm_min)(a, b)
+#define VMAX(a, b) SIMD_PS_PD(_mm_max)(a, b)
+#define VFMA(a, b, c) VADD(VMUL(a, b), c)
+#define VSCALE2N(p, n) sse2_scale2n(p, n)
+#include "simd_kernels.inc"
+#undef SIMD_PREFIX
+#undef SIMD_LEVEL
+#undef SIMD_NAME
+#undef SIMD_MR
+#undef SIMD_NR
+#undef V
+#undef VL
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VZERO
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VMIN
+#undef VMAX
+#undef VFMA
+#undef VROUND
+#undef VSCALE2N
+
+#pragma GCC pop_options
+
+//== AVX2 + FMA, 6x8 GEMM tile (6x16 in single precision, 12 accumulators) ==
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+#ifdef MLP_FLOAT32
+static inline __m256 avx2_scale2n(__m256 p, __m256 n) {
+    __m256i i = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(i));
+}
+#define V __m256
+#else
+static inline __m256d avx2_scale2n(__m256d p, __m256d n) {
+    __m256i i = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+    i = _mm256_slli_epi64(_mm256_add_epi64(i, _mm256_set1_epi64x(1023)), 52);
+    return _mm256_mul_pd(p, _mm256_castsi256_pd(i));
+}
+#define V __m256d
+#endif
+
+#define SIMD_PREFIX avx2
+#define SIMD_LEVEL SIMD_AVX2
+#define SIMD_NAME "avx2"
+#define VL (32 / (int)sizeof(mlp_real))
+#define SIMD_MR 6
+#define SIMD_NR (2 * VL)
+#define VLOAD(p) SIMD_PS_PD(_mm256_loadu)(p)
+#define VSTORE(p, v) SIMD_PS_PD(_mm256_storeu)(p, v)
+#define VSET1(x) SIMD_PS_PD(_mm256_set1)(x)
+#define VZERO SIMD_PS_PD(_mm256_setzero)()
+#define VADD(a, b) SIMD_PS_PD(_mm256_add)(a, b)
+#define VSUB(a, b) SIMD_PS_PD(_mm256_sub)(a, b)
+#define VMUL(a, b) SIMD_PS_PD(_mm256_mul)(a, b)
+#define VDIV(a, b) SIMD_PS_PD(_mm256_div)(a, b)
+#define VMIN(a, b) SIMD_PS_PD(_mm256_min)(a, b)
+#define VMAX(a, b) SIMD_PS_PD(_mm256_max)(a, b)
+#define VFMA(a, b, c) SIMD_PS_PD(_mm256_fmadd)(a, b, c)
+#define VROUND(x) SIMD_PS_PD(_mm256_round)(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define VSCALE2N(p, n) avx2_scale2n(p, n)
+#include "simd_kernels.inc"
+#undef SIMD_PREFIX
+#undef SIMD_LEVEL
+#undef SIMD_NAME
+#undef SIMD_MR
+#undef SIMD_NR
+#undef V
+#undef VL
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VZERO
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VMIN
+#undef VMAX
+#undef VFMA
+#undef VROUND
+#undef VSCALE2N
+
+#pragma GCC pop_options
+
+//== AVX-512F, 8x16 GEMM tile (8x32 in single precision, 16 of the 32 vector registers hold
+//accumulators) ==
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+
+#ifdef MLP_FLOAT32
+#define V __m512
+#else
+#define V __m512d
+#endif
+
+#define SIMD_PREFIX avx512
+#define SIMD_LEVEL SIMD_AVX512
+#define SIMD_NAME "avx512"
+#define VL (64 / (int)sizeof(mlp_real))
+#define SIMD_MR 8
+#define SIMD_NR (2 * VL)
+#define VLOAD(p) SIMD_PS_PD(_mm512_loadu)(p)
+#define VSTORE(p, v) SIMD_PS_PD(_mm512_storeu)(p, v)
+#define VSET1(x) SIMD_PS_PD(_mm512_set1)(x)
+#define VZERO SIMD_PS_PD(_mm512_setzero)()
+#define VADD(a, b) SIMD_PS_PD(_mm512_add)(a, b)
+#define VSUB(a, b) SIMD_PS_PD(_mm512_sub)(a, b)
+#define VMUL(a, b) SIMD_PS_PD(_mm512_mul)(a, b)
+#define VDIV(a, b) SIMD_PS_PD(_mm512_div)(a, b)
+#define VMIN(a, b) SIMD_PS_PD(_mm512_min)(a, b)
+#define VMAX(a, b) SIMD_PS_PD(_mm512_max)(a, b)
+#define VFMA(a, b, c) SIMD_PS_PD(_mm512_fmadd)(a, b, c)
+#define VROUND(x) SIMD_PS_PD(_mm512_roundscale)(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define VSCALE2N(p, n) SIMD_PS_PD(_mm512_scalef)(p, n)
+#include "simd_kernels.inc"
+#undef SIMD_PREFIX
+#undef SIMD_LEVEL
+#undef SIMD_NAME
+#undef SIMD_MR
+#undef SIMD_NR
+#undef V
+#undef VL
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VZERO
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VMIN
+#undef VMAX
+#undef VFMA
+#undef VROUND
+#undef VSCALE2N
+
+#pragma GCC pop_options
+
+#endif
+
+//Does the CPU support the instruction set (checked through CPUID)
+static int cpu_supports(SimdLevel level) {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    switch (level) {
+        case SIMD_GENERIC:
+            return 1;
+        case SIMD_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case SIMD_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case SIMD_AVX512:
+            return __builtin_cpu_supports("avx512f");
+    }
+    return 0;
+#else
+    return level == SIMD_GENERIC;
+#endif
+}
+
+const SimdKernels*
+simd_kernels_for(SimdLevel level) {
+    if (!cpu_supports(level))
+        return NULL;
+
+    switch (level) {
+#ifdef SIMD_X86
+        case SIMD_SSE2:
+            return &sse2_kernels;
+        case SIMD_AVX2:
+            return &avx2_kernels;
+        case SIMD_AVX512:
+            return &avx512_kernels;
+#endif
+        default:
+            return &generic_kernels;
+    }
+}
+
+//Pick the fastest supported instruction set, optionally capped by MLP_SIMD
+static const SimdKernels*
+select_kernels(void) {
+    SimdLevel max_level = SIMD_AVX512;
+    const char* names[] = {"generic", "sse2", "avx2", "avx512"};
+    const char* env = getenv("MLP_SIMD");
+    if (env != NULL) {
+        for (int i = SIMD_GENERIC; i <= SIMD_AVX512; i++) {
+            if (strcmp(env, names[i]) == 0)
+                max_level = (SimdLevel)i;
+        }
+    }
+
+    for (int level = max_level; level > SIMD_GENERIC; level--) {
+        const SimdKernels* kernels = simd_kernels_for((SimdLevel)level);
+        if (kernels != NULL)
+            return kernels;
+    }
+    return &generic_kernels;
+}
+
+const SimdKernels*
+simd_kernels(void) {
+    static const SimdKernels* selected = NULL;
+    const SimdKernels* kernels = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (kernels == NULL) {
+        //Selecting is idempotent so threads racing here all store the same table
+        kernels = select_kernels();
+        __atomic_store_n(&selected, kernels, __ATOMIC_RELEASE);
+    }
+    return kernels;
+}
+
+SigmoidKernel
+simd_sigmoid_kernel(const SimdKernels* kernels, SigmoidMode mode) {
+    switch (mode) {
+        case SIGMOID_FAST:
+            return kernels->sigmoid_fast;
+        case SIGMOID_EXACT:
+            return generic_sigmoid;
+        default:
+            return kernels->sigmoid;
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include "real.h"
+
+//Vectorized kernels for the matrix and MLP code. Every instruction set gets its own table of
+//kernels and the best one supported by the CPU is picked once (through CPUID) on first use,
+//so the same binary runs at full speed on any x86-64 host.
+
+//Instruction sets with kernels, from the slowest to the fastest
+typedef enum {
+    SIMD_GENERIC = 0,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512
+} SimdLevel;
+
+//Largest register tile of any GEMM micro-kernel (used to size packing buffers). The tiles are two
+//vectors wide so single precision doubles the columns
+#define SIMD_MAX_MR 8
+#ifdef MLP_FLOAT32
+#define SIMD_MAX_NR 32
+#else
+#define SIMD_MAX_NR 16
+#endif
+
+//Accuracy of the sigmoid kernels (maximum error relative to 1 / (1 + e^(-x)) in exact arithmetic)
+typedef enum {
+    //Vector e^x with a full Taylor series: 5e-16 in double precision, 1.4e-7 in single
+    SIGMOID_ACCURATE = 0,
+    //Vector e^x cut at r^5: 3.5e-6, up to 1.8x faster in double precision (less in single)
+    SIGMOID_FAST,
+    //One libm exp() call per element (slowest, rounding of the libm exp() only)
+    SIGMOID_EXACT
+} SigmoidMode;
+
+typedef void (*SigmoidKernel)(int n, mlp_real* x);
+
+typedef struct {
+    SimdLevel level;
+    const char* name;
+    //Register tile of the GEMM micro-kernel (rows of A x columns of B)
+    int gemm_mr;
+    int gemm_nr;
+    //c (gemm_mr x gemm_nr tile, clipped to rows x cols) += packed A panel * packed B panel
+    void (*gemm_micro_kernel)(int kc, const mlp_real* a, const mlp_real* b, mlp_real* c, int ldc, int rows, int cols);
+    //y += a[0] * b0 + a[1] * b1 + a[2] * b2 + a[3] * b3
+    void (*axpy4)(int n, const mlp_real* a, const mlp_real* b0, const mlp_real* b1, const mlp_real* b2, const mlp_real* b3, mlp_real* y);
+    //y += alpha * x
+    void (*axpy)(int n, mlp_real alpha, const mlp_real* x, mlp_real* y);
+    //Sum of x[i] * y[i]
+    mlp_real (*dot)(int n, const mlp_real* x, const mlp_real* y);
+    //c = a - b
+    void (*subtract)(int n, const mlp_real* a, const mlp_real* b, mlp_real* c);
+    //x = 1 / (1 + e^(-x)) (SIGMOID_ACCURATE and SIGMOID_FAST)
+    void (*sigmoid)(int n, mlp_real* x);
+    void (*sigmoid_fast)(int n, mlp_real* x);
+    //out = err * y * (1 - y), the sigmoid derivative expressed with the sigmoid output y
+    void (*sigmoid_grad)(int n, const mlp_real* y, const mlp_real* err, mlp_real* out);
+} SimdKernels;
+
+//Kernels for the best instruction set available. Setting the environment variable MLP_SIMD to
+//generic, sse2, avx2 or avx512 caps the choice (useful for testing and benchmarking)
+const SimdKernels* simd_kernels(void);
+
+//Sigmoid kernel of the table with the requested accuracy
+SigmoidKernel simd_sigmoid_kernel(const SimdKernels* kernels, SigmoidMode mode);
+
+//Kernels for a specific instruction set, NULL if this CPU (or build) does not support it
+const SimdKernels* simd_kernels_for(SimdLevel level);
+
+#endif
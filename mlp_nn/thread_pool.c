@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "log.h"
+#include "thread_pool.h"
+
+typedef struct {
+    pthread_t* workers;
+    int num_workers;
+    int running;
+    int shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    //Current job, a new generation wakes the workers up
+    unsigned long generation;
+    unsigned long start_generation;
+    ThreadPoolTask task;
+    void* ctx;
+    int num_tasks;
+    int next_task;
+    int busy_workers;
+} ThreadPool;
+
+static ThreadPool pool = {
+    NULL, 0, 0, 0,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    0, 0, NULL, NULL, 0, 0, 0
+};
+//Only one parallel run at a time
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+//Requested number of threads, 0 until configured
+static int requested_threads = 0;
+//Set while a thread is executing tasks so nested runs stay serial
+static __thread int inside_task = 0;
+
+//Grab task indices until there are none left
+static void run_tasks(void) {
+    int t;
+    inside_task = 1;
+    while ((t = __atomic_fetch_add(&pool.next_task, 1, __ATOMIC_RELAXED)) < pool.num_tasks)
+        pool.task(pool.ctx, t);
+    inside_task = 0;
+}
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool.lock);
+    //Start from the generation at creation time so a job published before this thread got
+    //scheduled is still picked up
+    unsigned long seen = pool.start_generation;
+    while (1) {
+        while (!pool.shutdown && pool.generation == seen)
+            pthread_cond_wait(&pool.work_cond, &pool.lock);
+        if (pool.shutdown)
+            break;
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_tasks();
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy_workers == 0)
+            pthread_cond_signal(&pool.done_cond);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+static int default_num_threads(void) {
+    const char* env = getenv("MLP_NUM_THREADS");
+    int threads = env != NULL ? atoi(env) : 0;
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return threads > 0 ? threads : 1;
+}
+
+int
+thread_pool_num_threads(void) {
+    int threads = __atomic_load_n(&requested_threads, __ATOMIC_RELAXED);
+    if (threads == 0) {
+        threads = default_num_threads();
+        __atomic_store_n(&requested_threads, threads, __ATOMIC_RELAXED);
+    }
+    return threads;
+}
+
+//Start the workers (the calling thread is the remaining one). Called with run_lock held
+static void start_workers(int num_threads) {
+    pool.workers = (pthread_t*)malloc((num_threads - 1) * sizeof(pthread_t));
+    pool.num_workers = 0;
+    pool.shutdown = 0;
+    pool.start_generation = pool.generation;
+    //Without workers every job runs on the calling thread
+    if (pool.workers == NULL && num_threads > 1)
+        mlp_log(MLP_LOG_ERROR, "Cannot allocate %d worker threads", num_threads - 1);
+    for (int i = 0; pool.workers != NULL && i < num_threads - 1; i++) {
+        if (pthread_create(&pool.workers[i], NULL, worker_main, NULL) != 0) {
+            mlp_log(MLP_LOG_ERROR, "Cannot create worker thread %d", i);
+            break;
+        }
+        pool.num_workers++;
+    }
+    pool.running = 1;
+}
+
+//Join the workers. Called with run_lock held
+static void stop_workers(void) {
+    if (!pool.running)
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.shutdown = 1;
+    pthread_cond_broadcast(&pool.work_cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < pool.num_workers; i++)
+        pthread_join(pool.workers[i], NULL);
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.num_workers = 0;
+    pool.running = 0;
+}
+
+void
+thread_pool_set_num_threads(int num_threads) {
+    pthread_mutex_lock(&run_lock);
+    stop_workers();
+    __atomic_store_n(&requested_threads, num_threads > 0 ? num_threads : default_num_threads(), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&run_lock);
+}
+
+void
+thread_pool_shutdown(void) {
+    pthread_mutex_lock(&run_lock);
+    stop_workers();
+    pthread_mutex_unlock(&run_lock);
+}
+
+void
+thread_pool_run(int num_tasks, ThreadPoolTask task, void* ctx) {
+    int threads = thread_pool_num_threads();
+    if (num_tasks <= 1 || threads <= 1 || inside_task) {
+        for (int t = 0; t < num_tasks; t++)
+            task(ctx, t);
+        return;
+    }
+
+    pthread_mutex_lock(&run_lock);
+    if (!pool.running)
+        start_workers(threads);
+
+    //Publish the job and wake the workers
+    pthread_mutex_lock(&pool.lock);
+    pool.task = task;
+    pool.ctx = ctx;
+    pool.num_tasks = num_tasks;
+    pool.next_task = 0;
+    pool.busy_workers = pool.num_workers;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work_cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_tasks();
+
+    //Wait for the workers to finish their last task
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy_workers > 0)
+        pthread_cond_wait(&pool.done_cond, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&run_lock);
+}
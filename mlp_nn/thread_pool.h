@@ -0,0 +1,24 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+//Persistent pool of worker threads used to split matrix work across cores. The workers are
+//created on the first parallel run and then sleep between jobs, so a run only costs a wake up.
+
+//A task of a parallel run, called once for every task index in [0, num_tasks)
+typedef void (*ThreadPoolTask)(void* ctx, int task);
+
+//Set the number of threads (including the calling thread). 0 uses the MLP_NUM_THREADS
+//environment variable or, when unset, the number of online CPUs. 1 makes every run serial
+void thread_pool_set_num_threads(int num_threads);
+
+//Number of threads a run is split across
+int thread_pool_num_threads(void);
+
+//Run all the tasks across the pool (the caller works on them too) and return when they are all
+//done. Runs issued from inside a task are executed serially by that thread
+void thread_pool_run(int num_tasks, ThreadPoolTask task, void* ctx);
+
+//Stop and join the worker threads (they are started again by the next parallel run)
+void thread_pool_shutdown(void);
+
+#endif
@@ -0,0 +1,105 @@
+#include "mlp_nn.h"
+
+//Train the 784-200-N network straight from IDX files (MNIST and the like) and report how long
+//loading, training and inference take along with the accuracy on a test set:
+//  ./train_idx train-images train-labels [test-images test-labels] [steps] [batch size]
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Share of the samples whose largest output is their label, evaluated in batches of plan->max_rows
+static double evaluate(MLP_NN* mlp, MLP_Plan* plan, const Dataset* dataset) {
+    Matrix inputs, outputs;
+    init_matrix(&inputs, plan->max_rows, dataset->num_inputs);
+    init_matrix(&outputs, plan->max_rows, dataset->num_classes);
+    int correct = 0;
+    for (int first = 0; first < (int)dataset->num_samples; first += plan->max_rows) {
+        int rows = (int)dataset->num_samples - first < plan->max_rows ? (int)dataset->num_samples - first : plan->max_rows;
+        resize_matrix(&inputs, rows, dataset->num_inputs);
+        for (int r = 0; r < rows; r++)
+            dataset_fetch(dataset, first + r, matrix_row(&inputs, r), matrix_row(&outputs, r));
+
+        Matrix* predicted = mlp_plan_forward(plan, mlp, &inputs);
+        for (int r = 0; r < rows; r++) {
+            const mlp_real* row = matrix_row(predicted, r);
+            unsigned int best = 0;
+            for (unsigned int c = 1; c < dataset->num_classes; c++) {
+                if (row[c] > row[best])
+                    best = c;
+            }
+            correct += best == dataset->labels[first + r];
+        }
+    }
+    free_matrix(&inputs);
+    free_matrix(&outputs);
+    return (double)correct / dataset->num_samples;
+}
+
+int
+main(int argc, char* argv[]) {
+    if (argc != 3 && argc < 5) {
+        fprintf(stderr, "Usage: %s <train images> <train labels> [<test images> <test labels> [steps] [batch size]]\n", argv[0]);
+        return 1;
+    }
+
+    double start = now_seconds();
+    Dataset train, test;
+    if (!load_idx_dataset(argv[1], argv[2], &train))
+        return 1;
+    int has_test = argc >= 5;
+    if (has_test && !load_idx_dataset(argv[3], argv[4], &test)) {
+        free_dataset(&train);
+        return 1;
+    }
+    printf("Loaded %u samples of %u x %u pixels and %u classes in %.3f s\n",
+           train.num_samples, train.width, train.height, train.num_classes, now_seconds() - start);
+
+    unsigned int hidden_layer_nodes[] = {200};
+    MLP_NN nn = {
+        .num_inputs = train.num_inputs,
+        .num_outputs = train.num_classes,
+        .num_hidden = hidden_layer_nodes,
+        .learning_rate = 0.05,
+        .epoch = argc > 5 ? atoi(argv[5]) : 10000,
+        .neurons = NULL, .weights = NULL,
+        .batch_size = argc > 6 ? atoi(argv[6]) : 32
+    };
+    size_t sz = initialize_rand_weights(&nn, sizeof(hidden_layer_nodes) / sizeof(hidden_layer_nodes[0]));
+
+    //The neurons are sized from a first sample
+    Matrix first, first_outputs;
+    init_matrix(&first, 1, nn.num_inputs);
+    init_matrix(&first_outputs, 1, nn.num_outputs);
+    dataset_fetch(&train, 0, matrix_row(&first, 0), matrix_row(&first_outputs, 0));
+    init_mlp_model(&nn, &first, sz);
+
+    //The samples are widened from the mapped pixels one batch at a time
+    MLP_SampleSource source = dataset_sample_source(&train);
+    start = now_seconds();
+    train_mlp_model_from_source(&nn, &source, sz);
+    double seconds = now_seconds() - start;
+    printf("Trained %d steps of %d samples in %.3f s (%.0f samples/s)\n",
+           nn.epoch, nn.batch_size, seconds, (double)nn.epoch * nn.batch_size / seconds);
+
+    MLP_Plan plan;
+    if (init_mlp_plan(&plan, &nn, sz, 256)) {
+        start = now_seconds();
+        double train_accuracy = evaluate(&nn, &plan, &train);
+        printf("Training accuracy: %.2f%% (%.0f samples/s)\n", 100 * train_accuracy, train.num_samples / (now_seconds() - start));
+        if (has_test)
+            printf("Test accuracy: %.2f%%\n", 100 * evaluate(&nn, &plan, &test));
+        free_mlp_plan(&plan);
+    }
+
+    free_matrix(&first);
+    free_matrix(&first_outputs);
+    free_mat_array(&nn.weights, sz);
+    free_mat_array(&nn.neurons, sz + 1);
+    free_dataset(&train);
+    if (has_test)
+        free_dataset(&test);
+    return 0;
+}